@@ -0,0 +1,209 @@
+/*
+  CombMask for AviSynth2.6x
+
+  Copyright (C) 2013 Oka Motofumi
+
+  Authors: Oka Motofumi (chikuzen.mo at gmail dot com)
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+*/
+
+
+
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
+#include <tuple>
+#include "CombMask.h"
+
+
+/*
+The results of IsCombed are recorded per frame. When the last two periods
+(10 frames) are known and repeat with a period of 5 frames, and have both
+combed and clean frames (as 3:2 pulldown does), the result of the frame
+one period before is the prediction.
+*/
+
+int Cadence::predict(int n)
+{
+    if (n < period * 2 || n >= static_cast<int>(history.size())) {
+        return -1;
+    }
+    std::lock_guard<std::mutex> lock(mtx);
+    int combed = 0;
+    for (int i = n - period * 2; i < n - period; ++i) {
+        if (history[i] < 0 || history[i] != history[i + period]) {
+            return -1;
+        }
+        combed += history[i];
+    }
+    if (combed == 0 || combed == period) {
+        return -1;
+    }
+    return history[n - period];
+}
+
+
+void Cadence::update(int n, bool is_combed)
+{
+    if (n < 0 || n >= static_cast<int>(history.size())) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mtx);
+    history[n] = is_combed ? 1 : 0;
+}
+
+
+typedef std::tuple<const void*, int, int, int, int, int, int, int, int,
+                   bool> tracker_key_t;
+
+struct tracker_t {
+    ise_t* owner;
+    std::unique_ptr<Cadence> cadence;
+};
+
+static std::mutex trackers_mtx;
+static std::map<tracker_key_t, tracker_t> trackers;
+static std::set<ise_t*> tracker_owners;
+
+
+static void __cdecl release_trackers(void* user_data, ise_t*)
+{
+    std::vector<std::unique_ptr<Cadence>> released;
+    {
+        std::lock_guard<std::mutex> lock(trackers_mtx);
+        for (auto it = trackers.begin(); it != trackers.end();) {
+            if (it->second.owner == user_data) {
+                released.push_back(std::move(it->second.cadence));
+                it = trackers.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        tracker_owners.erase(static_cast<ise_t*>(user_data));
+    }
+    // the clips are released out of the lock.
+}
+
+
+/*
+The trackers live across the calls of IsCombed, which is invoked for each
+frame. They are shared by the calls with the same clip and parameters, and
+are released with the clips they hold when the script environment which
+created them exits (a script reload).
+*/
+Cadence* Cadence::get(PClip clip, int cthresh, int mthresh, int mi,
+                      int blockx, int blocky, int stepx, int stepy,
+                      int metric, bool approx, ise_t* env)
+{
+    tracker_key_t key((void*)clip, cthresh, mthresh, mi, blockx, blocky,
+                      stepx, stepy, metric, approx);
+    std::lock_guard<std::mutex> lock(trackers_mtx);
+    if (tracker_owners.insert(env).second) {
+        env->AtExit(release_trackers, env);
+    }
+    auto& tracker = trackers[key];
+    if (!tracker.cadence) {
+        tracker.owner = env;
+        tracker.cadence.reset(new Cadence(clip));
+    }
+    return tracker.cadence.get();
+}
+
+
+static inline int reflect(int y, int height)
+{
+    return y < 0 ? -y : y > height - 1 ? 2 * (height - 1) - y : y;
+}
+
+
+static inline bool
+is_comb(int a, int b, int c, int d, int e, int cthresh, int metric)
+{
+    if (metric == 1) {
+        return (b - c) * (d - c) > cthresh;
+    }
+    int d1 = c - b;
+    int d2 = c - d;
+    if ((d1 > cthresh && d2 > cthresh) || (d1 < -cthresh && d2 < -cthresh)) {
+        int f = a + 4 * c + e - 3 * (b + d);
+        return (f > 0 ? f : -f) > cthresh * 6;
+    }
+    return false;
+}
+
+
+/*
+Sparse check of a frame predicted to be clean: only the center line of each
+band of blocky lines is evaluated, with the same metric and motion as
+CombMask. The frame fails when a blockx wide part of a line has more combed
+pixels than the average line of a block which has mi combed pixels.
+Pixels of YUY2 are evaluated on Y, and those of RGB32 on each of B, G and R.
+*/
+bool Cadence::verifyClean(PVideoFrame& src, PVideoFrame& prev, int cthresh,
+                          int mthresh, int mi, int blockx, int blocky,
+                          int metric, int pixel_size)
+{
+    const int width = src->GetRowSize(PLANAR_Y) / pixel_size;
+    const int comps = pixel_size == 4 ? 3 : 1;
+    const int height = src->GetHeight(PLANAR_Y);
+    const int spitch = src->GetPitch(PLANAR_Y);
+    const uint8_t* srcp = src->GetReadPtr(PLANAR_Y);
+    const int ppitch = mthresh > 0 ? prev->GetPitch(PLANAR_Y) : 0;
+    const uint8_t* prevp = mthresh > 0 ? prev->GetReadPtr(PLANAR_Y) : nullptr;
+
+    if (height < 3) {
+        return true;
+    }
+
+    for (int y = blocky / 2; y < height; y += blocky) {
+        const uint8_t* l[5];
+        for (int i = 0; i < 5; ++i) {
+            l[i] = srcp + reflect(y + i - 2, height) * spitch;
+        }
+        const uint8_t* m[3];
+        const uint8_t* s[3];
+        for (int i = 0; i < 3; ++i) {
+            int r = std::min(std::max(y + i - 1, 0), height - 1);
+            m[i] = prevp ? prevp + r * ppitch : nullptr;
+            s[i] = srcp + r * spitch;
+        }
+
+        for (int bx = 0; bx + blockx <= width; bx += blockx) {
+            int count = 0;
+            for (int px = bx; px < bx + blockx; ++px) {
+                bool combed = false;
+                for (int x = px * pixel_size; x < px * pixel_size + comps
+                        && !combed; ++x) {
+                    if (prevp && std::abs(s[0][x] - m[0][x]) <= mthresh
+                            && std::abs(s[1][x] - m[1][x]) <= mthresh
+                            && std::abs(s[2][x] - m[2][x]) <= mthresh) {
+                        continue;
+                    }
+                    combed = is_comb(l[0][x], l[1][x], l[2][x], l[3][x],
+                                     l[4][x], cthresh, metric);
+                }
+                count += combed;
+            }
+            if (count * blocky > mi) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
@@ -24,17 +24,12 @@
 #include <cstdint>
 #include <string>
 #include <algorithm>
-#include <malloc.h>
+#include <cstring>
 #include "CombMask.h"
-#include "simd.h"
+#include "kernels.h"
 
 
 
-static __forceinline int absdiff(int x, int y) noexcept
-{
-    return x > y ? x - y : y - x;
-}
-
 /*
 How to detect combs (quoted from TFM - README.txt written by tritical)
 
@@ -61,22 +56,26 @@ How to detect combs (quoted from TFM - README.txt written by tritical)
 */
 
 
-static void __stdcall
-comb_mask_0_c(uint8_t* dstp, const uint8_t* srcp, const int dpitch,
-              const int spitch, const int cthresh, const int width,
-              const int height) noexcept
+static __forceinline void
+comb_lines_0_c(uint8_t* dstp, const int dpitch, const uint8_t* srcp,
+               const int spitch, const int cthresh, const int width,
+               const int height, const int y, const int rows,
+               const uint8_t* mrow) noexcept
 {
-    const uint8_t* sc = srcp;
-    const uint8_t* sb = sc + spitch;
-    const uint8_t* sa = sb + spitch;
-    const uint8_t* sd = sc + spitch;
-    const uint8_t* se = sd + spitch;
-
     const int cth6 = cthresh * 6;
 
-    for (int y = 0; y < height; ++y) {
+    for (int i = y; i < y + rows; ++i) {
+        const uint8_t* sa = srcp + mirror_line(i - 2, height) * spitch;
+        const uint8_t* sb = srcp + mirror_line(i - 1, height) * spitch;
+        const uint8_t* sc = srcp + i * spitch;
+        const uint8_t* sd = srcp + mirror_line(i + 1, height) * spitch;
+        const uint8_t* se = srcp + mirror_line(i + 2, height) * spitch;
+        uint8_t* dstl = dstp + (i - y) * dpitch;
         for (int x = 0; x < width; ++x) {
-            dstp[x] = 0;
+            if (mrow && mrow[x >> 4] == 0) {
+                continue;
+            }
+            dstl[x] = 0;
             int d1 = sc[x] - sb[x];
             int d2 = sc[x] - sd[x];
             if ((d1 > cthresh && d2 > cthresh)
@@ -84,144 +83,52 @@ comb_mask_0_c(uint8_t* dstp, const uint8_t* srcp, const int dpitch,
                 int f0 = sa[x] + 4 * sc[x] + se[x];
                 int f1 = 3 * (sb[x] + sd[x]);
                 if (absdiff(f0, f1) > cth6) {
-                    dstp[x] = 0xFF;
+                    dstl[x] = 0xFF;
                 }
             }
         }
-        sa = sb;
-        sb = sc;
-        sc = sd;
-        sd = se;
-        se += (y < height - 3) ? spitch : -spitch;
-        dstp += dpitch;
     }
 }
 
 
-static void __stdcall
-comb_mask_1_c(uint8_t* dstp, const uint8_t* srcp, const int dpitch,
-              const int spitch, const int cthresh, const int width,
-              const int height) noexcept
+static __forceinline void
+comb_lines_1_c(uint8_t* dstp, const int dpitch, const uint8_t* srcp,
+               const int spitch, const int cthresh, const int width,
+               const int height, const int y, const int rows,
+               const uint8_t* mrow) noexcept
 {
-    const uint8_t* sc = srcp;
-    const uint8_t* sb = sc + spitch;
-    const uint8_t* sd = sc + spitch;
-
-    for (int y = 0; y < height; ++y) {
+    for (int i = y; i < y + rows; ++i) {
+        const uint8_t* sb = srcp + mirror_line(i - 1, height) * spitch;
+        const uint8_t* sc = srcp + i * spitch;
+        const uint8_t* sd = srcp + mirror_line(i + 1, height) * spitch;
+        uint8_t* dstl = dstp + (i - y) * dpitch;
         for (int x = 0; x < width; ++x) {
+            if (mrow && mrow[x >> 4] == 0) {
+                continue;
+            }
             int val = (sb[x] - sc[x]) * (sd[x] - sc[x]);
-            dstp[x] = val > cthresh ? 0xFF : 0;
+            dstl[x] = val > cthresh ? 0xFF : 0;
         }
-        sb = sc;
-        sc = sd;
-        sd += (y < height - 2) ? spitch : -spitch;
-        dstp += dpitch;
     }
 }
 
 
-template <typename V>
-static void __stdcall
-comb_mask_0_simd(uint8_t* dstp, const uint8_t* srcp, const int dpitch,
-                 const int spitch, const int cthresh, const int width,
-                 const int height) noexcept
+static void
+dilate_motion_c(uint8_t* dstp, uint8_t* mapp, const uint8_t* tmpp,
+                const int dpitch, const int tpitch, const int mpitch,
+                const int width, const int height) noexcept
 {
-    const uint8_t* sc = srcp;
-    const uint8_t* sb = sc + spitch;
-    const uint8_t* sa = sb + spitch;
-    const uint8_t* sd = sc + spitch;
-    const uint8_t* se = sd + spitch;
-
-    int16_t cth16 = static_cast<int16_t>(cthresh);
-    const V cthp = set1_i16<V>(cth16);
-    const V cthn = set1_i16<V>(-cth16);
-    const V cth6 = set1_i16<V>(cth16 * 6);
-
-    constexpr int step = sizeof(V) / 2;
-
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; x += step) {
-            V xc = load_half<V>(sc + x);
-            V xb = load_half<V>(sb + x);
-            V xd = load_half<V>(sd + x);
-            V d1 = sub_i16(xc, xb);
-            V d2 = sub_i16(xc, xd);
-            V mask0 = or_reg(
-                and_reg(cmpgt_i16(d1, cthp), cmpgt_i16(d2, cthp)),
-                and_reg(cmpgt_i16(cthn, d1), cmpgt_i16(cthn, d2)));
-            d2 = mul3(add_i16(xb, xd));
-            d1 = add_i16(load_half<V>(sa + x), load_half<V>(se + x));
-            d1 = add_i16(d1, lshift_i16(xc, 2));
-            mask0 = and_reg(mask0, cmpgt_i16(absdiff_i16(d1, d2), cth6));
-            store_half(dstp + x, mask0);
-        }
-        sa = sb;
-        sb = sc;
-        sc = sd;
-        sd = se;
-        se += (y < height - 3) ? spitch : -spitch;
-        dstp += dpitch;
-    }
-}
-
-
-template <typename V>
-static void __stdcall
-comb_mask_1_simd(uint8_t* dstp, const uint8_t* srcp, const int dpitch,
-                 const int spitch, const int cthresh, const int width,
-                 const int height) noexcept
-{
-    const uint8_t* sc = srcp;
-    const uint8_t* sb = sc + spitch;
-    const uint8_t* sd = sc + spitch;
-
-    const V cth = set1_i16<V>(static_cast<int16_t>(cthresh));
-    const V all = cmpeq_i8(cth, cth);
-
-    constexpr int step = sizeof(V) / 2;
-
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; x += step) {
-            V xb = load_half<V>(sb + x);
-            V xc = load_half<V>(sc + x);
-            V xd = load_half<V>(sd + x);
-            xb = sub_i16(xb, xc);
-            xd = sub_i16(xd, xc);
-            xc = andnot(mulhi(xb, xd), mullo(xb, xd));
-            xc = cmpgt_u16(xc, cth, all);
-            store_half(dstp + x, xc);
-        }
-        sb = sc;
-        sc = sd;
-        sd += (y < height - 2) ? spitch : -spitch;
-        dstp += dpitch;
-    }
-}
-
-
-static void __stdcall
-motion_mask_c(uint8_t* tmpp, uint8_t* dstp, const uint8_t* srcp,
-              const uint8_t* prevp, const int tpitch, const int dpitch,
-              const int spitch, const int ppitch, const int mthresh,
-              const int width, const int height) noexcept
-{
-    uint8_t* tx = tmpp;
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            tx[x] = absdiff(srcp[x], prevp[x]) > mthresh ? 0xFF : 0;
-        }
-        tx += tpitch;
-        srcp += spitch;
-        prevp += ppitch;
-    }
-
     const uint8_t* t0 = tmpp;
     const uint8_t *t1 = tmpp;
     const uint8_t *t2 = tmpp + tpitch;
 
+    std::memset(mapp, 0, mpitch * ((height + 15) >> 4));
+
     for (int y = 0; y < height; ++y) {
+        uint8_t* mrow = mapp + (y >> 4) * mpitch;
         for (int x = 0; x < width; ++x) {
             dstp[x] = (t0[x] | t1[x] | t2[x]);
+            mrow[x >> 4] |= dstp[x];
         }
         t0 = t1;
         t1 = t2;
@@ -233,44 +140,31 @@ motion_mask_c(uint8_t* tmpp, uint8_t* dstp, const uint8_t* srcp,
 }
 
 
-template <typename V>
+/*
+srcp[0] is the previous frame of srcp[1], and srcp[1] to srcp[count] are
+consecutive frames. Each source row is loaded only once and is shared by the
+pairs (i - 1, i) and (i, i + 1).
+*/
 static void __stdcall
-motion_mask_simd(uint8_t* tmpp, uint8_t* dstp, const uint8_t* srcp,
-                 const uint8_t* prevp, const int tpitch, const int dpitch,
-                 const int spitch, const int ppitch, const int mthresh,
-                 const int width, const int height) noexcept
+motion_mask_c(uint8_t** tmpp, uint8_t** dstp, const uint8_t** srcp,
+              const int tpitch, const int* dpitch, const int* spitch,
+              const int mthresh, const int width, const int height,
+              uint8_t** mapp, const int mpitch, const int count) noexcept
 {
-    uint8_t* tx = tmpp;
-    const V mth = set1_i8<V>(static_cast<int8_t>(mthresh));
-    const V all = cmpeq_i8(mth, mth);
-
     for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; x += sizeof(V)) {
-            V diff = absdiff_u8(load<V>(srcp + x), load<V>(prevp + x));
-            V dst = cmpgt_u8(diff, mth, all);
-            store(tx + x, dst);
+        for (int x = 0; x < width; ++x) {
+            int s0 = srcp[0][x + y * spitch[0]];
+            for (int i = 0; i < count; ++i) {
+                int s1 = srcp[i + 1][x + y * spitch[i + 1]];
+                tmpp[i][x + y * tpitch] = absdiff(s1, s0) > mthresh ? 0xFF : 0;
+                s0 = s1;
+            }
         }
-        tx += tpitch;
-        srcp += spitch;
-        prevp += ppitch;
     }
 
-    const uint8_t* t0 = tmpp;
-    const uint8_t* t1 = tmpp;
-    const uint8_t* t2 = tmpp + tpitch;
-
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; x += sizeof(V)) {
-            V dst = or_reg(load<V>(t0 + x), load<V>(t1 + x));
-            dst = or_reg(dst, load<V>(t2 + x));
-            store(dstp + x, dst);
-        }
-        t0 = t1;
-        t1 = t2;
-        if (y < height - 2) {
-            t2 += tpitch;
-        }
-        dstp += dpitch;
+    for (int i = 0; i < count; ++i) {
+        dilate_motion_c(dstp[i], mapp[i], tmpp[i], dpitch[i], tpitch, mpitch,
+                        width, height);
     }
 }
 
@@ -289,32 +183,34 @@ and_masks_c(uint8_t* dstp, const uint8_t* altp, const int dpitch,
 }
 
 
-template <typename V>
 static void __stdcall
-and_masks_simd(uint8_t* dstp, const uint8_t* altp, const int dpitch,
-               const int apitch, const int width, const int height) noexcept
+expand_mask_c(uint8_t* dstp, const uint8_t* srcp, const int dpitch,
+              const int spitch, const int width, const int height) noexcept
 {
     for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; x += sizeof(V)) {
-            V d = load<V>(dstp + x);
-            V a = load<V>(altp + x);
-            store(dstp + x, and_reg(d, a));
+        for (int x = 0; x < width; ++x) {
+            dstp[x] = (srcp[x - 1] | srcp[x] | srcp[x + 1]);
         }
+        srcp += spitch;
         dstp += dpitch;
-        altp += apitch;
     }
 }
 
 
+/*
+On YUY2 and RGB32, the left and right pixels of a byte are STEP bytes away on
+Y (even bytes) and 4 bytes away on the other components.
+*/
+template <int STEP>
 static void __stdcall
-expand_mask_c(uint8_t* dstp, uint8_t* srcp, const int dpitch, const int spitch,
-              const int width, const int height) noexcept
+expand_mask_packed_c(uint8_t* dstp, const uint8_t* srcp, const int dpitch,
+                     const int spitch, const int width,
+                     const int height) noexcept
 {
     for (int y = 0; y < height; ++y) {
-        srcp[-1] = srcp[0];
-        srcp[width] = srcp[width - 1];
         for (int x = 0; x < width; ++x) {
-            dstp[x] = (srcp[x - 1] | srcp[x] | srcp[x + 1]);
+            const int d = (x & 1) ? 4 : STEP;
+            dstp[x] = (srcp[x - d] | srcp[x] | srcp[x + d]);
         }
         srcp += spitch;
         dstp += dpitch;
@@ -322,31 +218,62 @@ expand_mask_c(uint8_t* dstp, uint8_t* srcp, const int dpitch, const int spitch,
 }
 
 
-template <typename V>
-static void __stdcall
-expand_mask_simd(uint8_t* dstp, uint8_t* srcp, const int dpitch,
-                 const int spitch, const int width, const int height) noexcept
+/*
+A pixel can be combed only if it differs from both of its vertical neighbors
+by more than thresh (cthresh on metric 0, its square root on metric 1).
+is_flat returns true if no adjacent lines of the plane differ that much,
+which is the case of black frames, fades and slates. It stops at the first
+line which has such a difference.
+*/
+static bool __stdcall
+is_flat_c(const uint8_t* srcp, const int pitch, const int width,
+          const int height, const int thresh) noexcept
+{
+    for (int y = 1; y < height; ++y) {
+        const uint8_t* above = srcp;
+        srcp += pitch;
+        for (int x = 0; x < width; ++x) {
+            if (absdiff(above[x], srcp[x]) > thresh) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+// returns true if no pixel of the lines exceeds level.
+static bool __stdcall
+is_dark_c(const uint8_t* srcp, const int pitch, const int width,
+          const int height, const int level) noexcept
 {
     for (int y = 0; y < height; ++y) {
-        srcp[-1] = srcp[0];
-        srcp[width] = srcp[width - 1];
-        for (int x = 0; x < width; x += sizeof(V)) {
-            V s0 = loadu<V>(srcp + x - 1);
-            V s1 = load<V>(srcp + x);
-            V s2 = loadu<V>(srcp + x + 1);
-            stream(dstp + x, or_reg(or_reg(s0, s1), s2));
+        for (int x = 0; x < width; ++x) {
+            if (srcp[x] > level) {
+                return false;
+            }
         }
-        srcp += spitch;
-        dstp += dpitch;
+        srcp += pitch;
     }
+    return true;
 }
 
 
-Buffer::Buffer(size_t pitch, int height, int hsize, size_t align, bool ip,
-    ise_t* e) :
+static void clear_planes(PVideoFrame& frame, int num_planes)
+{
+    static const int planes[] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+    for (int p = 0; p < num_planes; ++p) {
+        std::memset(frame->GetWritePtr(planes[p]), 0,
+                    frame->GetPitch(planes[p]) * frame->GetHeight(planes[p]));
+    }
+}
+
+
+Buffer::Buffer(size_t pitch, int height, int hsize, size_t extra, size_t align,
+    bool ip, ise_t* e) :
     env(e), isPlus(ip)
 {
-    size_t size = pitch * height * hsize + align;
+    size_t size = pitch * height * hsize + extra + align;
     orig = alloc_buffer(size, align, isPlus, env);
     buffp = reinterpret_cast<uint8_t*>(orig) + align;
 }
@@ -360,11 +287,15 @@ Buffer::~Buffer()
 
 
 CombMask::CombMask(PClip c, int cth, int mth, bool ch, arch_t arch, bool e,
-                   int metric, bool plus) :
+                   int metric, int bt, bool plus, int tr, int ct, int cb,
+                   bool lb, int fld, bool lc, ise_t* env) :
     GVFmod(c, ch, arch, plus), cthresh(cth), mthresh(mth), expand(e),
-    buff(nullptr)
+    batch(bt), buff(nullptr), cacheStart(0), cacheCount(0), trust(tr),
+    cropTop(ct), cropBottom(cb), letterbox(lb), field(fld),
+    lumaChroma(lc && numPlanes == 3), ssw(0), ssh(0), lumaBytes(nullptr)
 {
-    validate(!vi.IsPlanar(), "planar format only.");
+    validate(!vi.IsPlanar() && !vi.IsYUY2() && !vi.IsRGB32(),
+             "planar, YUY2 and RGB32 formats only.");
     validate(metric != 0 && metric != 1, "metric must be set to 0 or 1.");
     if (metric == 0) {
         validate(cthresh < 0 || cthresh > 255,
@@ -374,47 +305,110 @@ CombMask::CombMask(PClip c, int cth, int mth, bool ch, arch_t arch, bool e,
                  "cthresh must be between 0 and 65025 on metric 1.");
     }
     validate(mthresh < 0 || mthresh > 255, "mthresh must be between 0 and 255.");
+    validate(batch < 1 || batch > maxBatch, "batch must be between 1 and 16.");
+    validate(trust < 0 || trust > (TRUST_COMBED | TRUST_FIELD_BASED),
+             "trust must be between 0 and 3.");
+    validate(cropTop < 0 || cropTop > vi.height / 2 - 4,
+             "croptop must be between 0 and height / 2 - 4.");
+    validate(cropBottom < 0 || cropBottom > vi.height / 2 - 4,
+             "cropbottom must be between 0 and height / 2 - 4.");
+    validate(field < -1 || field > 1, "field must be set to -1, 0 or 1.");
+    validate(letterbox && !vi.IsPlanar(), "letterbox requires planar formats.");
+    if (lumaChroma) {
+        ssw = vi.GetPlaneWidthSubsampling(PLANAR_U);
+        ssh = vi.GetPlaneHeightSubsampling(PLANAR_U);
+    }
 
+    if (trust != 0) {
+        bool has_props = true;
+        try {
+            env->CheckVersion(8);
+        } catch (const AvisynthError&) {
+            has_props = false;
+        }
+        validate(!has_props, "trust requires AviSynth+ with frame properties.");
+
+        blank = env->NewVideoFrame(vi, align);
+        clear_planes(blank, vi.IsPlanar() && !vi.IsY8() ? 3 : 1);
+        env->propSetInt(env->getFramePropsRW(blank), "_Combed", 0,
+                        PROPAPPENDMODE_REPLACE);
+    }
 
-    buffPitch = vi.width + align - 1;
+    flatThresh = cthresh;
+    if (metric == 1) {
+        for (flatThresh = 0; (flatThresh + 1) * (flatThresh + 1) <= cthresh;
+                ++flatThresh);
+    }
+
+    // the buffer and the block map are of the first plane in bytes.
+    const int rowsize = vi.BytesFromPixels(vi.width);
+    buffPitch = rowsize + align - 1;
     if (expand) {
-        buffPitch += 2;
+        buffPitch += vi.IsPlanar() ? 2 : 8;
     }
     buffPitch &= (~(align - 1));
     needBuff = mthresh > 0 || expand;
-
-    switch (arch) {
-#if defined(__AVX2__)
-    case USE_AVX2:
-        writeCombMask = metric == 0 ? comb_mask_0_simd<__m256i>
-                      : comb_mask_1_simd<__m256i>;
-        writeMotionMask = motion_mask_simd<__m256i>;
-        andMasks = and_masks_simd<__m256i>;
-        expandMask = expand_mask_simd<__m256i>;
-        break;
-#endif
-    case USE_SSE2:
-        writeCombMask = metric == 0 ? comb_mask_0_simd<__m128i>
-                      : comb_mask_1_simd<__m128i>;
-        writeMotionMask = motion_mask_simd<__m128i>;
-        andMasks = and_masks_simd<__m128i>;
-        expandMask = expand_mask_simd<__m128i>;
-        break;
-    default:
-        writeCombMask = metric == 0 ? comb_mask_0_c : comb_mask_1_c;
+    mapPitch = ((rowsize + align - 1) & ~(align - 1)) / 16;
+    mapSize = mthresh > 0 ? mapPitch * ((vi.height + 15) / 16) : 0;
+    combSize = buffPitch * comb_rows
+        + ((vi.height * 4 + align - 1) & ~(align - 1));
+
+    // the stages after the motion pass are specialized for the metric, the
+    // format, mthresh > 0 and expand.
+    const int format = vi.IsPlanar() ? 0 : vi.IsYUY2() ? 1 : 2;
+    if (arch == NO_SIMD) {
+        static const select_pipeline_t pipelines[2][3] = {
+            {
+                select_pipeline<comb_lines_0_c, and_masks_c, expand_mask_c,
+                                1>,
+                select_pipeline<comb_lines_0_c, and_masks_c,
+                                expand_mask_packed_c<2>, 4>,
+                select_pipeline<comb_lines_0_c, and_masks_c,
+                                expand_mask_packed_c<4>, 4>,
+            },
+            {
+                select_pipeline<comb_lines_1_c, and_masks_c, expand_mask_c,
+                                1>,
+                select_pipeline<comb_lines_1_c, and_masks_c,
+                                expand_mask_packed_c<2>, 4>,
+                select_pipeline<comb_lines_1_c, and_masks_c,
+                                expand_mask_packed_c<4>, 4>,
+            },
+        };
+        writeMask = pipelines[metric][format](mthresh > 0, expand);
         writeMotionMask = motion_mask_c;
         andMasks = and_masks_c;
-        expandMask = expand_mask_c;
+        isFlat = is_flat_c;
+        maskFromLuma = mask_from_luma_c;
+        isDark = is_dark_c;
+    } else {
+        const simd_kernels_t& k = *get_kernels(arch);
+        writeMask = k.pipeline[metric][format](mthresh > 0, expand);
+        writeMotionMask = k.motionMask;
+        andMasks = k.andMasks;
+        isFlat = k.isFlat;
+        maskFromLuma = k.maskFromLuma;
+        isDark = k.isDark;
     }
 
-    if (mthresh > 0 && child->SetCacheHints(CACHE_GET_WINDOW, 0) < 3) {
-        child->SetCacheHints(CACHE_WINDOW, 3);
+    if (mthresh > 0
+            && child->SetCacheHints(CACHE_GET_WINDOW, 0) < batch + 2) {
+        child->SetCacheHints(CACHE_WINDOW, batch + 2);
     }
 
+    // the buffer of writeMask, and the motion masks and block maps.
     if (!isPlus && needBuff) {
-        buff = new Buffer(buffPitch, vi.height, mthresh > 0 ? 2 : 1, align,
-                          false, nullptr);
+        buff = new Buffer(buffPitch, vi.height, mthresh > 0 ? batch : 0,
+                          combSize + mapSize * batch, align, false,
+                          nullptr);
+
+    }
 
+    if (vi.IsYUY2() && !ch) {
+        lumaBytes = new Buffer(buffPitch, 1, 1, 0, align, false, nullptr);
+        for (size_t x = 0; x < buffPitch; ++x) {
+            lumaBytes->buffp[x] = (x & 1) ? 0 : 0xFF;
+        }
     }
 }
 
@@ -424,71 +418,242 @@ CombMask::~CombMask()
     if (!isPlus && needBuff) {
         delete buff;
     }
+    delete lumaBytes;
 }
 
 
-PVideoFrame __stdcall CombMask::GetFrame(int n, ise_t* env)
+/*
+The active picture area of src is the frame without croptop and cropbottom,
+and without the letterbox bars if letterbox=true. Bars are the lines of luma
+which are not brighter than barLevel at the top and bottom, up to a third of
+the height each. Real bars are shorter than that, so a frame which is dark
+over a third of its height on either side is taken as a dark picture (a fade
+to black) and gets no bars. The area depends on src only.
+*/
+void CombMask::getRoi(PVideoFrame& src, int& top, int& bottom) const
 {
-    static const int planes[] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+    top = cropTop;
+    bottom = vi.height - cropBottom;
+    if (!letterbox) {
+        return;
+    }
+
+    const uint8_t* srcp = src->GetReadPtr(PLANAR_Y);
+    const int pitch = src->GetPitch(PLANAR_Y);
+    const int width = src->GetRowSize(PLANAR_Y);
+    const int height = vi.height;
+
+    const int max_bar = height / 3;
+    int bt, bb;
+    for (bt = 0; bt < max_bar; ++bt) {
+        if (!isDark(srcp + bt * pitch, pitch, width, 1, barLevel)) {
+            break;
+        }
+    }
+    for (bb = height; bb > height - max_bar; --bb) {
+        if (!isDark(srcp + (bb - 1) * pitch, pitch, width, 1, barLevel)) {
+            break;
+        }
+    }
+    if (bt == max_bar || bb == height - max_bar) {
+        return;
+    }
+
+    top = std::max(top, bt);
+    bottom = std::min(bottom, bb);
+}
+
 
-    PVideoFrame src = child->GetFrame(n, env);
+/*
+Creates the masks of frames n to n + count - 1 at once. The motion stage reads
+all of the source frames in one pass, so each of them is loaded only once
+instead of twice (as current and as previous frame).
+*/
+void CombMask::GetFrames(int n, int count, PVideoFrame* dst, ise_t* env)
+{
+    static const int planes[] = { PLANAR_Y, PLANAR_U, PLANAR_V };
 
-    PVideoFrame prev = mthresh == 0 ? PVideoFrame() 
-                     : child->GetFrame(std::max(n - 1, 0), env);
+    // src[0] is the previous frame of src[1].
+    PVideoFrame src[maxBatch + 1];
+    for (int i = 0; i < count; ++i) {
+        src[i + 1] = child->GetFrame(n + i, env);
+        dst[i] = env->NewVideoFrame(vi, align);
+    }
+    if (mthresh > 0) {
+        src[0] = n == 0 ? src[1] : child->GetFrame(n - 1, env);
+    }
 
-    PVideoFrame dst = env->NewVideoFrame(vi, align);
+    // the frames of a batch share the motion pass, thus they need the same
+    // area. a batch over a change of the letterbox is made frame by frame, so
+    // that each mask depends on its own frame only.
+    int top, bottom;
+    getRoi(src[1], top, bottom);
+    for (int i = 2; i <= count; ++i) {
+        int t, b;
+        getRoi(src[i], t, b);
+        if (t != top || b != bottom) {
+            for (int j = 0; j < count; ++j) {
+                GetFrames(n + j, 1, dst + j, env);
+            }
+            return;
+        }
+    }
 
     Buffer* b = buff;
-    uint8_t *buffp, *tmpp;
+    uint8_t* buffp = nullptr;
+    uint8_t* tmpp[maxBatch];
+    uint8_t* mapp[maxBatch];
     if (needBuff) {
         if (isPlus) {
-            b = new Buffer(buffPitch, vi.height, mthresh > 0 ? 2 : 1, align,
-                           isPlus, env);
+            b = new Buffer(buffPitch, vi.height, mthresh > 0 ? count : 0,
+                           combSize + mapSize * count, align, isPlus,
+                           env);
         }
         buffp = b->buffp;
-        tmpp = buffp + vi.height * buffPitch;
+        uint8_t* motionp = buffp + combSize;
+        for (int i = 0; i < count; ++i) {
+            tmpp[i] = motionp + vi.height * buffPitch * i;
+            mapp[i] = motionp + vi.height * buffPitch * count + mapSize * i;
+        }
     }
 
-    for (int p = 0; p < numPlanes; ++p) {
+    for (int p = 0; p < (lumaChroma ? 1 : numPlanes); ++p) {
         const int plane = planes[p];
 
-        const uint8_t* srcp = src->GetReadPtr(plane);
-        uint8_t* dstp = dst->GetWritePtr(plane);
-        const int spitch = src->GetPitch(plane);
-        const int dpitch = dst->GetPitch(plane);
-        const int width = src->GetRowSize(plane);
-        const int height = src->GetHeight(plane);
+        const uint8_t* srcp[maxBatch + 1];
+        uint8_t* dstp[maxBatch];
+        int spitch[maxBatch + 1];
+        int dpitch[maxBatch];
+        for (int i = mthresh > 0 ? 0 : 1; i <= count; ++i) {
+            srcp[i] = src[i]->GetReadPtr(plane);
+            spitch[i] = src[i]->GetPitch(plane);
+        }
+        for (int i = 0; i < count; ++i) {
+            dstp[i] = dst[i]->GetWritePtr(plane);
+            dpitch[i] = dst[i]->GetPitch(plane);
+        }
+        const int width = src[1]->GetRowSize(plane);
+        const int ss = p == 0 ? 0 : vi.GetPlaneHeightSubsampling(plane);
+        const int ptop = top >> ss;
+        const int height = ((bottom + (1 << ss) - 1) >> ss) - ptop;
+        const int pheight = src[1]->GetHeight(plane);
+        // the parity of field is of the frame, not of the first line of roi.
+        const int pfield = field < 0 ? -1 : (field ^ ptop) & 1;
+
+        for (int i = mthresh > 0 ? 0 : 1; i <= count; ++i) {
+            srcp[i] += ptop * spitch[i];
+        }
+        for (int i = 0; i < count; ++i) {
+            std::memset(dstp[i], 0, ptop * dpitch[i]);
+            dstp[i] += ptop * dpitch[i];
+            std::memset(dstp[i] + height * dpitch[i], 0,
+                        (pheight - ptop - height) * dpitch[i]);
+        }
 
-        if (!needBuff) {
-            writeCombMask(dstp, srcp, dpitch, spitch, cthresh, width, height);
-            continue;
+        // motion goes first so that the comb pass can skip static blocks.
+        if (mthresh > 0) {
+            writeMotionMask(tmpp, dstp, srcp, buffPitch, dpitch, spitch,
+                            mthresh, width, height, mapp, mapPitch, count);
         }
 
-        writeCombMask(buffp, srcp, buffPitch, spitch, cthresh, width, height);
+        for (int i = 0; i < count; ++i) {
+            writeMask(dstp[i], buffp, srcp[i + 1], dpitch[i], buffPitch,
+                      spitch[i + 1], cthresh, width, height,
+                      mthresh > 0 ? mapp[i] : nullptr, mapPitch, pfield);
+        }
 
-        if (mthresh == 0) {
-            expandMask(dstp, buffp, dpitch, buffPitch, width, height);
-            continue;
+        if (lumaBytes) {
+            for (int i = 0; i < count; ++i) {
+                andMasks(dstp[i], lumaBytes->buffp, dpitch[i], 0, width,
+                         height);
+            }
         }
+    }
 
-        writeMotionMask(tmpp, dstp, srcp, prev->GetReadPtr(plane), buffPitch,
-                        dpitch, spitch, prev->GetPitch(plane), mthresh, width,
-                        height);
+    if (isPlus && needBuff) {
+        delete b;
+    }
 
-        if (!expand) {
-            andMasks(dstp, buffp, dpitch, buffPitch, width, height);
-            continue;
+    if (!lumaChroma) {
+        return;
+    }
+    for (int i = 0; i < count; ++i) {
+        const uint8_t* lumap = dst[i]->GetReadPtr(PLANAR_Y);
+        const int lpitch = dst[i]->GetPitch(PLANAR_Y);
+        for (int p = 1; p < 3; ++p) {
+            const int plane = planes[p];
+            maskFromLuma(dst[i]->GetWritePtr(plane), lumap,
+                         dst[i]->GetPitch(plane), lpitch,
+                         dst[i]->GetRowSize(plane), dst[i]->GetHeight(plane),
+                         ssw, ssh);
         }
+    }
+}
 
-        andMasks(buffp, dstp, buffPitch, dpitch, width, height);
 
-        expandMask(dstp, buffp, dpitch, buffPitch, width, height);
-    }
+bool CombMask::isTrustedClean(PVideoFrame& src, ise_t* env)
+{
+    const AVSMap* props = env->getFramePropsRO(src);
+    int err;
 
-    if (isPlus && needBuff) {
-        delete b;
+    if (trust & TRUST_COMBED) {
+        int64_t combed = env->propGetInt(props, "_Combed", 0, &err);
+        if (!err && combed == 0) {
+            return true;
+        }
     }
+    if (trust & TRUST_FIELD_BASED) {
+        int64_t field_based = env->propGetInt(props, "_FieldBased", 0, &err);
+        if (!err && field_based == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
 
-    return dst;
+bool CombMask::isFlatFrame(PVideoFrame& src)
+{
+    static const int planes[] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+    for (int p = 0; p < (lumaChroma ? 1 : numPlanes); ++p) {
+        const int plane = planes[p];
+        if (!isFlat(src->GetReadPtr(plane), src->GetPitch(plane),
+                    src->GetRowSize(plane), src->GetHeight(plane),
+                    flatThresh)) {
+            return false;
+        }
+    }
+    return true;
 }
 
+
+PVideoFrame __stdcall CombMask::GetFrame(int n, ise_t* env)
+{
+    // frames which can't be combed skip all of the stages.
+    {
+        PVideoFrame src = child->GetFrame(n, env);
+        if ((trust != 0 && isTrustedClean(src, env)) || isFlatFrame(src)) {
+            if (!blank) {
+                PVideoFrame dst = env->NewVideoFrame(vi, align);
+                clear_planes(dst, vi.IsPlanar() && !vi.IsY8() ? 3 : 1);
+                return dst;
+            }
+            return blank;
+        }
+    }
+
+    if (batch == 1) {
+        PVideoFrame dst;
+        GetFrames(n, 1, &dst, env);
+        return dst;
+    }
+
+    // sequential requests are served from the last batch.
+    if (n < cacheStart || n >= cacheStart + cacheCount) {
+        cacheStart = n;
+        cacheCount = std::max(std::min(batch, vi.num_frames - n), 1);
+        GetFrames(n, cacheCount, cache, env);
+    }
+
+    return cache[n - cacheStart];
+}
@@ -2,6 +2,10 @@
 #define COMB_MASK_H
 
 #include <stdexcept>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#if defined(_WIN32)
 #include <malloc.h>
 #define WIN32_LEAN_AND_MEAN
 #define VC_EXTRALEAN
@@ -9,6 +13,35 @@
 #define NOGDI
 #include <windows.h>
 #include <avisynth.h>
+#else
+#include <cstdlib>
+#include <avisynth.h>
+// AviSynth+ on Linux and so on. its headers may define some of these.
+#ifndef __stdcall
+#define __stdcall
+#endif
+#ifndef __cdecl
+#define __cdecl
+#endif
+#ifndef __forceinline
+#define __forceinline inline __attribute__((always_inline))
+#endif
+#ifndef __declspec
+#define __declspec(x)
+#endif
+#ifndef _aligned_malloc
+static inline void* _aligned_malloc(size_t size, size_t alignment)
+{
+    void* p;
+    return posix_memalign(&p, alignment, size) == 0 ? p : nullptr;
+}
+
+static inline void _aligned_free(void* p)
+{
+    free(p);
+}
+#endif
+#endif
 
 #define CMASK_VERSION "1.1.1"
 
@@ -20,20 +53,122 @@ enum arch_t {
     NO_SIMD = 0,
     USE_SSE2 = 1,
     USE_AVX2 = 2,
+    USE_AVX512 = 3,
+    USE_NEON = 4,
+};
+
+
+// upstream frame props trusted by CombMask(trust).
+enum trust_t {
+    TRUST_COMBED = 1,      // _Combed=0 means the frame is clean.
+    TRUST_FIELD_BASED = 2, // _FieldBased=0 means the frame is progressive.
 };
 
 
+// the lines of the comb mask made at once by comb_pipeline (see kernels.h).
+constexpr int comb_rows = 4;
+
+// the bytes of the column strips of comb_pipeline. planes up to this width
+// (8K at 8 bits) are not split, their lines already stay in L2.
+constexpr int strip_width = 8192;
+
+// writes the mask of a plane after the motion pass (see kernels.h).
+// buffp: comb_rows lines of bpitch, and 4 bytes per line of the plane.
+// mapp: one byte per 16x16 block, zero means the block can be skipped. it is
+// used only if the motion mask is in dstp.
+typedef void (__stdcall *comb_pipeline_t)(
+    uint8_t* dstp, uint8_t* buffp, const uint8_t* srcp, const int dpitch,
+    const int bpitch, const int spitch, const int cthresh, const int width,
+    const int height, const uint8_t* mapp, const int mpitch, const int field);
+
+// picks the comb_pipeline_t of mthresh > 0 (motion) and expand.
+typedef comb_pipeline_t (*select_pipeline_t)(bool motion, bool expand);
+
+typedef void (__stdcall *motion_mask_t)(
+    uint8_t** tmpp, uint8_t** dstp, const uint8_t** srcp, const int tpitch,
+    const int* dpitch, const int* spitch, const int mthresh,
+    const int width, const int height, uint8_t** mapp, const int mpitch,
+    const int count);
+
+typedef void (__stdcall *and_masks_t)(
+    uint8_t* dstp, const uint8_t* altp, const int dpitch, const int apitch,
+    const int width, const int height);
+
+// reads 1 byte (4 on YUY2 and RGB32) out of each side of srcp (see pad_line).
+typedef void (__stdcall *expand_mask_t)(
+    uint8_t* dstp, const uint8_t* srcp, const int dpitch, const int spitch,
+    const int width, const int height);
+
+// is_flat and is_dark.
+typedef bool (__stdcall *check_lines_t)(
+    const uint8_t* srcp, const int pitch, const int width,
+    const int height, const int thresh);
+
+typedef void (__stdcall *mask_from_luma_t)(
+    uint8_t* dstp, const uint8_t* lumap, const int dpitch,
+    const int lpitch, const int width, const int height, const int ssw,
+    const int ssh);
+
+typedef void (__stdcall *merge_frames_t)(
+    const uint8_t* srcp, const uint8_t* altp, const uint8_t* mskp,
+    uint8_t* dstp, const int spitch, const int apitch, const int mpitch,
+    const int dpitch, const int width, const int height);
+
+// srcp: the Y plane of the mask. hint: the band to be scanned first. it is set
+// to the band which was found to be combed.
+typedef bool (__stdcall *check_combed_t)(
+    const uint8_t* srcp, const int pitch, const int rowsize, const int height,
+    int mi, int blockx, int blocky, int stepx, int stepy, int& hint,
+    bool is_avsplus, ise_t* env);
+
+
+// the SIMD routines built for an instruction set (see kernels.h).
+struct simd_kernels_t {
+    select_pipeline_t pipeline[2][3];     // metric 0, 1 x planar, YUY2, RGB32
+    motion_mask_t motionMask;
+    and_masks_t andMasks;
+    expand_mask_t expandMask[3];          // planar, YUY2, RGB32
+    check_lines_t isFlat;
+    check_lines_t isDark;
+    mask_from_luma_t maskFromLuma;
+    merge_frames_t mergeFrames[2];        // all bytes, Y bytes of YUY2
+    check_combed_t checkCombed[3][3];     // blockx, blocky of 8, 16, 32
+    check_combed_t checkCombedWindow[3];  // planar, YUY2, RGB32
+};
+
+// nullptr if the compiler couldn't build the instruction set.
+const simd_kernels_t* get_kernels_sse2();
+const simd_kernels_t* get_kernels_avx2();
+const simd_kernels_t* get_kernels_avx512();
+const simd_kernels_t* get_kernels_neon();
+
+static inline const simd_kernels_t* get_kernels(arch_t arch)
+{
+    return arch == USE_NEON ? get_kernels_neon()
+         : arch == USE_AVX512 ? get_kernels_avx512()
+         : arch == USE_AVX2 ? get_kernels_avx2() : get_kernels_sse2();
+}
+
+
 class Buffer {
     ise_t* env;
     bool isPlus;
     void* orig;
 public:
     uint8_t* buffp;
-    Buffer(size_t pitch, int height, int hsize, size_t align, bool ip, ise_t* e);
+    Buffer(size_t pitch, int height, int hsize, size_t extra, size_t align,
+           bool ip, ise_t* e);
     ~Buffer();
 };
 
 
+/*
+Source frames are read with unaligned loads, so cropped clips can be used
+without crop(align=true) and AVX2 works with the 16 byte aligned frames of
+Avisynth2.6. A line is read up to its row size rounded up to the vector size,
+which stays inside the padding of the frame buffer. The frames and buffers
+written by the filters are allocated with align.
+*/
 class GVFmod : public GenericVideoFilter {
 protected:
     bool isPlus;
@@ -41,9 +176,11 @@ protected:
     size_t align;
 
     GVFmod(PClip c, bool chroma, arch_t a, bool ip) :
-        GenericVideoFilter(c), align(a == USE_AVX2 ? 32 : 16), isPlus(ip) 
+        GenericVideoFilter(c),
+        align(a == USE_AVX512 ? 64 : a == USE_AVX2 ? 32 : 16), isPlus(ip) 
     {
-        numPlanes = (vi.IsY8() || !chroma) ? 1 : 3;
+        // YUY2 and RGB32 are processed as one plane of interleaved bytes.
+        numPlanes = (!vi.IsPlanar() || vi.IsY8() || !chroma) ? 1 : 3;
     }
     int __stdcall SetCacheHints(int hints, int)
     {
@@ -53,41 +190,117 @@ protected:
 
 
 class CombMask : public GVFmod {
+    static constexpr int maxBatch = 16;
+
     int cthresh;
     int mthresh;
     bool expand;
+    int batch;
     bool needBuff;
     size_t buffPitch;
+    size_t mapPitch;
+    size_t mapSize;
+    size_t combSize;
     Buffer* buff;
 
-    void (__stdcall *writeCombMask)(
-        uint8_t* dstp, const uint8_t* srcp, const int dpitch, const int cpitch,
-        const int cthresh, const int width, const int height);
+    int cacheStart;
+    int cacheCount;
+    PVideoFrame cache[maxBatch];
+
+    // frames which the props tell to be clean get this empty mask.
+    int trust;
+    PVideoFrame blank;
+    bool isTrustedClean(PVideoFrame& src, ise_t* env);
+
+    // the largest vertical difference which can't make a comb.
+    int flatThresh;
+    bool isFlatFrame(PVideoFrame& src);
+
+    // luma lines from top to bottom - 1 are processed, and the others are
+    // cleared.
+    static constexpr int barLevel = 24;
+    int cropTop;
+    int cropBottom;
+    bool letterbox;
+    void getRoi(PVideoFrame& src, int& top, int& bottom) const;
+
+    // the parity of the lines on which combs are evaluated, or -1 for both.
+    int field;
+
+    // U/V masks are made from the Y mask instead of being detected.
+    bool lumaChroma;
+    int ssw;
+    int ssh;
+
+    // a line of 0xFF on Y and 0 on U/V, ANDed with the masks of YUY2 clips
+    // when chroma=false. nullptr on the other formats.
+    Buffer* lumaBytes;
+
+    comb_pipeline_t writeMask;
+    motion_mask_t writeMotionMask;
+    and_masks_t andMasks;
+    check_lines_t isFlat;
+    check_lines_t isDark;
+    mask_from_luma_t maskFromLuma;
 
-    void (__stdcall *writeMotionMask)(
-        uint8_t* tmpp, uint8_t* dstp, const uint8_t* srcp, const uint8_t* prevp,
-        const int tpitch, const int dpitch, const int spitch, const int ppitch,
-        const int mthresh, const int width, const int height);
+public:
+    CombMask(PClip c, int cth, int mth, bool chroma, arch_t arch, bool expand,
+             int metric, int batch, bool is_avsplus, int trust, int croptop,
+             int cropbottom, bool letterbox, int field, bool lumachroma,
+             ise_t* env);
+    ~CombMask();
+    void GetFrames(int n, int count, PVideoFrame* dst, ise_t* env);
+    PVideoFrame __stdcall GetFrame(int n, ise_t* env);
+    int __stdcall SetCacheHints(int hints, int)
+    {
+        // batch mode keeps the last batch, thus it can't be shared by threads.
+        if (hints == CACHE_GET_MTMODE) {
+            return batch > 1 ? MT_SERIALIZED : MT_NICE_FILTER;
+        }
+        return 0;
+    }
+};
 
-    void (__stdcall *andMasks)(
-        uint8_t* dstp, const uint8_t* altp, const int dpitch, const int apitch,
-        const int width, const int height);
 
-    void (__stdcall *expandMask)(
-        uint8_t* dstp, uint8_t* srcp, const int dpitch, const int spitch,
+// decimated luma used by IsCombed(approx=true).
+class Lattice : public GenericVideoFilter {
+    void (__stdcall *decimate)(
+        uint8_t* dstp, const uint8_t* srcp, const int dpitch, const int spitch,
         const int width, const int height);
 
 public:
-    CombMask(PClip c, int cth, int mth, bool chroma, arch_t arch, bool expand,
-             int metric, bool is_avsplus);
-    ~CombMask();
+    Lattice(PClip c, arch_t arch);
     PVideoFrame __stdcall GetFrame(int n, ise_t* env);
+    int __stdcall SetCacheHints(int hints, int)
+    {
+        return hints == CACHE_GET_MTMODE ? MT_NICE_FILTER : 0;
+    }
 };
 
 
-typedef bool (__stdcall *check_combed_t)(
-    PVideoFrame& cmask, int mi, int blockx, int blocky, bool is_avsplus,
-    ise_t* env);
+// 3:2 pulldown cadence tracker of IsCombed(cadence=true).
+class Cadence {
+    static constexpr int period = 5;
+
+    std::mutex mtx;
+    std::vector<int8_t> history; // -1: unknown, 0: clean, 1: combed
+    // holds the clip, so that its address isn't reused by another clip.
+    PClip clip;
+
+    Cadence(PClip c) :
+        history(c->GetVideoInfo().num_frames, -1), clip(c) {}
+
+public:
+    // -1 if the cadence is not locked, otherwise the predicted result.
+    int predict(int n);
+    void update(int n, bool is_combed);
+    static Cadence* get(PClip clip, int cthresh, int mthresh, int mi,
+                        int blockx, int blocky, int stepx, int stepy,
+                        int metric, bool approx, ise_t* env);
+    static bool verifyClean(PVideoFrame& src, PVideoFrame& prev, int cthresh,
+                            int mthresh, int mi, int blockx, int blocky,
+                            int metric, int pixel_size);
+};
 
 
 class MaskedMerge : public GVFmod {
@@ -96,22 +309,26 @@ class MaskedMerge : public GVFmod {
     int mi;
     int blockx;
     int blocky;
+    int stepx;
+    int stepy;
+    std::atomic<int> hotBand;
 
     check_combed_t checkCombed;
-
-    void (__stdcall *mergeFrames)(
-        int mum_planes, PVideoFrame& src, PVideoFrame& alt, PVideoFrame& mask,
-        PVideoFrame& dst);
+    merge_frames_t mergeFrames;
 
 public:
     MaskedMerge(PClip c, PClip a, PClip m, int mi, int blockx, int blocky,
-                bool chroma, arch_t arch, bool is_avsplus);
+                int stepx, int stepy, bool chroma, arch_t arch,
+                bool is_avsplus);
     ~MaskedMerge() {}
     PVideoFrame __stdcall GetFrame(int n, ise_t* env);
 };
 
 
-check_combed_t get_check_combed(arch_t arch);
+// pixel_size: bytes per pixel of the mask, 2 on YUY2 (only Y is counted) and 4
+// on RGB32 (a pixel is combed if any of B, G and R is), otherwise 1.
+check_combed_t get_check_combed(arch_t arch, int blockx, int blocky,
+                                int stepx, int stepy, int pixel_size);
 
 
 static inline void validate(bool cond, const char* msg)
@@ -120,6 +337,20 @@ static inline void validate(bool cond, const char* msg)
 }
 
 
+static inline void
+validate_blocks(int mi, int blockx, int blocky, int stepx, int stepy)
+{
+    validate(blockx < 4 || blockx > 256, "blockx must be between 4 and 256.");
+    validate(blocky < 4 || blocky > 256, "blocky must be between 4 and 256.");
+    validate(stepx < 1 || stepx > blockx,
+             "stepx must be between 1 and blockx.");
+    validate(stepy < 1 || stepy > blocky,
+             "stepy must be between 1 and blocky.");
+    validate(mi < 0 || (mi > 128 && mi > blockx * blocky),
+             "mi must be between 0 and max(128, blockx * blocky).");
+}
+
+
 static inline void*
 alloc_buffer(size_t size, size_t align, bool is_avsplus, ise_t* env)
 {
@@ -0,0 +1,109 @@
+/*
+  CombMask for AviSynth2.6x
+
+  Copyright (C) 2013 Oka Motofumi
+
+  Authors: Oka Motofumi (chikuzen.mo at gmail dot com)
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+*/
+
+
+#include <cstdint>
+#include <algorithm>
+#include "CombMask.h"
+#include "simd.h"
+
+
+/*
+Luma of the source sampled on a lattice: every other column, and the first
+8 lines of every 16 lines. Lines are kept in runs of 8 so that the 5 taps of
+the comb metric still see neighbouring lines of both fields.
+*/
+
+static inline int source_line(int y)
+{
+    return (y / 8) * 16 + (y & 7);
+}
+
+
+static void __stdcall
+decimate_c(uint8_t* dstp, const uint8_t* srcp, const int dpitch,
+           const int spitch, const int width, const int height)
+{
+    for (int y = 0; y < height; ++y) {
+        const uint8_t* s = srcp + spitch * source_line(y);
+        for (int x = 0; x < width; ++x) {
+            dstp[x] = s[2 * x];
+        }
+        dstp += dpitch;
+    }
+}
+
+
+template <typename V>
+static void __stdcall
+decimate_simd(uint8_t* dstp, const uint8_t* srcp, const int dpitch,
+              const int spitch, const int width, const int height)
+{
+    const V even = set1_i16<V>(0x00FF);
+    const int w16 = width & ~15;
+
+    for (int y = 0; y < height; ++y) {
+        const uint8_t* s = srcp + spitch * source_line(y);
+        for (int x = 0; x < w16; x += 16) {
+            V s0 = and_reg(loadu<V>(s + 2 * x), even);
+            V s1 = and_reg(loadu<V>(s + 2 * x + 16), even);
+            store(dstp + x, packus_i16(s0, s1));
+        }
+        for (int x = w16; x < width; ++x) {
+            dstp[x] = s[2 * x];
+        }
+        dstp += dpitch;
+    }
+}
+
+
+Lattice::Lattice(PClip c, arch_t arch) : GenericVideoFilter(c)
+{
+    validate(!vi.IsPlanar(), "planar format only.");
+    validate(vi.width < 32 || vi.height < 16,
+             "clip is too small for approx mode.");
+
+    vi.pixel_type = VideoInfo::CS_Y8;
+    vi.width /= 2;
+    vi.height = vi.height / 16 * 8 + std::min(vi.height % 16, 8);
+
+#if defined(SIMD_NEON)
+    decimate = arch == NO_SIMD ? decimate_c : decimate_simd<uint8x16_t>;
+#elif defined(SIMD_SSE2)
+    decimate = arch == NO_SIMD ? decimate_c : decimate_simd<__m128i>;
+#else
+    decimate = decimate_c;
+#endif
+}
+
+
+PVideoFrame __stdcall Lattice::GetFrame(int n, ise_t* env)
+{
+    PVideoFrame src = child->GetFrame(n, env);
+    PVideoFrame dst = env->NewVideoFrame(vi, 32);
+
+    decimate(dst->GetWritePtr(PLANAR_Y), src->GetReadPtr(PLANAR_Y),
+             dst->GetPitch(PLANAR_Y), src->GetPitch(PLANAR_Y), vi.width,
+             vi.height);
+
+    return dst;
+}
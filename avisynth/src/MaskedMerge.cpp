@@ -1,200 +1,133 @@
+#include <algorithm>
+#include <cstring>
 #include "CombMask.h"
-#include "simd.h"
+#include "kernels.h"
 
 
-template <typename V>
 static bool __stdcall
-check_combed_simd(PVideoFrame& cmask, int mi, int blockx, int blocky,
-                  bool is_avsplus, ise_t* env)
+check_combed_c(const uint8_t* srcp, const int pitch, const int rowsize,
+               const int height, int mi, int blockx, int blocky, int, int,
+               int& hint, bool, ise_t*)
 {
-    const int width = cmask->GetRowSize(PLANAR_Y) & (~(blockx - 1));
-    const int height = cmask->GetHeight(PLANAR_Y) & (~(blocky - 1));
-    const int pitch = cmask->GetPitch(PLANAR_Y);
-
-    const uint8_t* srcp = cmask->GetReadPtr(PLANAR_Y);
-
-    size_t pitch_a = (width + 31) & (~31);
-    uint8_t* arr = reinterpret_cast<uint8_t*>(
-        alloc_buffer(pitch_a * 4, 32, is_avsplus, env));
-    int64_t* array[] = {
-        reinterpret_cast<int64_t*>(arr),
-        reinterpret_cast<int64_t*>(arr + pitch_a),
-        reinterpret_cast<int64_t*>(arr + pitch_a * 2),
-        reinterpret_cast<int64_t*>(arr + pitch_a * 3),
-    };
-    int length = width / sizeof(int64_t);
-    int stepx = blockx / 8;
-    int stepy = blocky / 8;
-
-    const V zero = setzero<V>();
-
-    for (int y = 0; y < height; y += 32) {
-        for (int j = 0; j < 4; ++j) {
-            for (int x = 0; x < width; x += sizeof(V)) {
-                // 0xFF == -1, thus the range of each bytes of sum is -8 to 0.
-                V sum = load<V>(srcp + x);
-                sum = add_i8(sum, load<V>(srcp + x + pitch * 1));
-                sum = add_i8(sum, load<V>(srcp + x + pitch * 2));
-                sum = add_i8(sum, load<V>(srcp + x + pitch * 3));
-                sum = add_i8(sum, load<V>(srcp + x + pitch * 4));
-                sum = add_i8(sum, load<V>(srcp + x + pitch * 5));
-                sum = add_i8(sum, load<V>(srcp + x + pitch * 6));
-                sum = add_i8(sum, load<V>(srcp + x + pitch * 7));
-                sum = sad_u8(sub_i8(zero, sum), zero);
-                store(arr + x + pitch_a * j, sum);
-            }
-            srcp += pitch * 8;
-        }
-
-        for (int xx = 0; xx < length; xx += stepx) {
-            int64_t sum = 0;
-            for (int by = 0; by < stepy; ++by) {
-                for (int bx = 0; bx < stepx; ++bx) {
-                    sum += array[by][xx + bx];
-                }
-            }
-            if (sum > mi) {
-                free_buffer(arr, is_avsplus, env);
-                return true;
-            }
-        }
-    }
-    free_buffer(arr, is_avsplus, env);
-    return false;
-}
+    const int width = rowsize & (~(blockx - 1));
+    const int bands = height / blocky;
 
+    int band = hint > 0 && hint < bands ? hint : 0;
 
-static bool __stdcall
-check_combed_c(PVideoFrame& cmask, int mi, int blockx, int blocky, bool, ise_t*)
-{
-    const int width = cmask->GetRowSize(PLANAR_Y) & (~(blockx - 1));
-    const int height = cmask->GetHeight(PLANAR_Y) & (~(blocky - 1));
-    const int pitch = cmask->GetPitch(PLANAR_Y);
-
-    const uint8_t* srcp = cmask->GetReadPtr(PLANAR_Y);
-
-    for (int y = 0; y < height; y += blocky) {
+    for (int b = 0; b < bands; ++b, ++band) {
+        if (band == bands) {
+            band = 0;
+        }
+        const uint8_t* s = srcp + band * blocky * pitch;
         for (int x = 0; x < width; x += blockx) {
             int count = 0;
             for (int i = 0; i < blocky; ++i) {
                 for (int j = 0; j < blockx; ++j) {
-                    count += (srcp[x + j + i * pitch] & 1);
+                    count += (s[x + j + i * pitch] & 1);
                 }
             }
             if (count > mi) {
+                hint = band;
                 return true;
             }
         }
-        srcp += pitch * blocky;
     }
     return false;
 }
 
 
-template <typename V>
+template <bool LUMA_ONLY>
 static void __stdcall
-merge_frames_simd(int num_planes, PVideoFrame& src, PVideoFrame& alt,
-                  PVideoFrame& mask, PVideoFrame& dst)
+merge_frames_c(const uint8_t* srcp, const uint8_t* altp, const uint8_t* mskp,
+               uint8_t* dstp, const int spitch, const int apitch,
+               const int mpitch, const int dpitch, const int width,
+               const int height)
 {
-    static const int planes[] = { PLANAR_Y, PLANAR_U, PLANAR_V };
-
-    for (int p = 0; p < num_planes; ++p) {
-        const int plane = planes[p];
-
-        const uint8_t* srcp = src->GetReadPtr(plane);
-        const uint8_t* altp = alt->GetReadPtr(plane);
-        const uint8_t* mskp = mask->GetReadPtr(plane);
-        uint8_t* dstp = dst->GetWritePtr(plane);
-
-        const int width = src->GetRowSize(plane);
-        const int height = src->GetHeight(plane);
-
-        const int spitch = src->GetPitch(plane);
-        const int apitch = alt->GetPitch(plane);
-        const int mpitch = mask->GetPitch(plane);
-        const int dpitch = dst->GetPitch(plane);
-
-        for (int y = 0; y < height; y++) {
-            for (int x = 0; x < width; x += sizeof(V)) {
-                const V s = load<V>(srcp + x);
-                const V a = load<V>(altp + x);
-                const V m = load<V>(mskp + x);
-
-                stream(dstp + x, blendv(s, a, m));
-            }
-            srcp += spitch;
-            altp += apitch;
-            mskp += mpitch;
-            dstp += dpitch;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            const uint8_t m = LUMA_ONLY && (x & 1) ? 0 : mskp[x];
+            dstp[x] = (srcp[x] & (~m)) | (altp[x] & m);
         }
+        srcp += spitch;
+        altp += apitch;
+        mskp += mpitch;
+        dstp += dpitch;
     }
 }
 
 
-static void __stdcall
-merge_frames_c(int num_planes, PVideoFrame& src, PVideoFrame& alt,
-               PVideoFrame& mask, PVideoFrame& dst)
+// see check_combed_window in kernels.h.
+static void
+accumulate_lines_c(int16_t* colsum, const uint8_t* srcp, const int pitch,
+                   const int width, const int lines, const bool sub)
 {
-    static const int planes[] = { PLANAR_Y, PLANAR_U, PLANAR_V };
-
-    for (int p = 0; p < num_planes; ++p) {
-        const int plane = planes[p];
-        const uint8_t* srcp = src->GetReadPtr(plane);
-        const uint8_t* altp = alt->GetReadPtr(plane);
-        const uint8_t* mskp = mask->GetReadPtr(plane);
-        uint8_t* dstp = dst->GetWritePtr(plane);
-
-        const int width = src->GetRowSize(plane);
-        const int height = src->GetHeight(plane);
-
-        const int spitch = src->GetPitch(plane);
-        const int apitch = alt->GetPitch(plane);
-        const int mpitch = mask->GetPitch(plane);
-        const int dpitch = dst->GetPitch(plane);
-
-        for (int y = 0; y < height; y++) {
-            for (int x = 0; x < width; x++) {
-                dstp[x] = (srcp[x] & (~mskp[x])) | (altp[x] & mskp[x]);
-            }
-            srcp += spitch;
-            altp += apitch;
-            mskp += mpitch;
-            dstp += dpitch;
+    for (int y = 0; y < lines; ++y) {
+        for (int x = 0; x < width; ++x) {
+            colsum[x] += sub ? -(srcp[x] & 1) : (srcp[x] & 1);
         }
+        srcp += pitch;
     }
 }
 
 
+template <int PIXEL_SIZE>
+static void
+accumulate_lines_packed_c(int16_t* colsum, const uint8_t* srcp,
+                          const int pitch, const int width, const int lines,
+                          const bool sub)
+{
+    for (int y = 0; y < lines; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const uint8_t* p = srcp + x * PIXEL_SIZE;
+            const int m = (PIXEL_SIZE == 4 ? p[0] | p[1] | p[2] : p[0]) & 1;
+            colsum[x] += sub ? -m : m;
+        }
+        srcp += pitch;
+    }
+}
 
 
-check_combed_t get_check_combed(arch_t arch)
+check_combed_t get_check_combed(arch_t arch, int blockx, int blocky, int stepx,
+                                int stepy, int pixel_size)
 {
-
-#if defined(__AVX2__)
-    if (arch == USE_AVX2) {
-        return check_combed_simd<__m256i>;
+    bool fixed = stepx == blockx && stepy == blocky &&
+        (blockx == 8 || blockx == 16 || blockx == 32) &&
+        (blocky == 8 || blocky == 16 || blocky == 32);
+
+    // packed masks are always counted on the windows of pixels.
+    if (arch != NO_SIMD) {
+        const simd_kernels_t& k = *get_kernels(arch);
+        if (pixel_size == 2) {
+            return k.checkCombedWindow[1];
+        }
+        if (pixel_size == 4) {
+            return k.checkCombedWindow[2];
+        }
+        if (!fixed) {
+            return k.checkCombedWindow[0];
+        }
+        return k.checkCombed[blockx / 16][blocky / 16];
+    }
+    if (pixel_size == 2) {
+        return check_combed_window<accumulate_lines_packed_c<2>, 2>;
     }
-#endif
-    if (arch == USE_SSE2) {
-        return check_combed_simd<__m128i>;
+    if (pixel_size == 4) {
+        return check_combed_window<accumulate_lines_packed_c<4>, 4>;
     }
-    return check_combed_c;
+    return fixed ? check_combed_c : check_combed_window<accumulate_lines_c, 1>;
 }
 
 
 
 MaskedMerge::
-MaskedMerge(PClip c, PClip a, PClip m, int _mi, int bx, int by, bool chroma,
-            arch_t arch, bool ip) :
+MaskedMerge(PClip c, PClip a, PClip m, int _mi, int bx, int by, int sx,
+            int sy, bool chroma, arch_t arch, bool ip) :
     GVFmod(c, chroma, arch, ip), altc(a), maskc(m), mi(_mi), blockx(bx),
-    blocky(by)
+    blocky(by), stepx(sx), stepy(sy), hotBand(0)
 {
-    validate(!vi.IsPlanar(), "planar format only.");
-    validate(mi < 0 || mi > 128, "mi must be between 0 and 128.");
-    validate(blockx < 8 || blockx > 32 || blockx % 8 > 0,
-             "blockx must be set to 8, 16 or 32.");
-    validate(blocky < 8 || blocky > 32 || blocky % 8 > 0,
-             "blocky must be set to 8, 16 or 32.");
+    validate(!vi.IsPlanar() && !vi.IsYUY2() && !vi.IsRGB32(),
+             "planar, YUY2 and RGB32 formats only.");
+    validate_blocks(mi, blockx, blocky, stepx, stepy);
 
     const VideoInfo& a_vi = altc->GetVideoInfo();
     const VideoInfo& m_vi = maskc->GetVideoInfo();
@@ -204,20 +137,16 @@ MaskedMerge(PClip c, PClip a, PClip m, int _mi, int bx, int by, bool chroma,
              vi.height != a_vi.height || vi.height != m_vi.height,
              "unmatch resolutions.");
 
-    switch (arch) {
-#if defined(__AVX2__)
-    case USE_AVX2:
-        mergeFrames = merge_frames_simd<__m256i>;
-        break;
-#endif
-    case USE_SSE2:
-        mergeFrames = merge_frames_simd<__m128i>;
-        break;
-    default:
-        mergeFrames = merge_frames_c;
+    const bool luma_only = vi.IsYUY2() && !chroma;
+
+    if (arch == NO_SIMD) {
+        mergeFrames = luma_only ? merge_frames_c<true> : merge_frames_c<false>;
+    } else {
+        mergeFrames = get_kernels(arch)->mergeFrames[luma_only];
     }
 
-    checkCombed = get_check_combed(arch);
+    checkCombed = get_check_combed(arch, blockx, blocky, stepx, stepy,
+                                   vi.BytesFromPixels(1));
 }
 
 
@@ -225,16 +154,31 @@ PVideoFrame __stdcall MaskedMerge::GetFrame(int n, ise_t* env)
 {
     PVideoFrame src = child->GetFrame(n, env);
     PVideoFrame mask = maskc->GetFrame(n, env);
-    if (mi > 0 && !checkCombed(mask, mi, blockx, blocky, isPlus, env)) {
-        return src;
+    if (mi > 0) {
+        int hint = hotBand.load(std::memory_order_relaxed);
+        if (!checkCombed(mask->GetReadPtr(PLANAR_Y), mask->GetPitch(PLANAR_Y),
+                         mask->GetRowSize(PLANAR_Y), mask->GetHeight(PLANAR_Y),
+                         mi, blockx, blocky, stepx, stepy, hint, isPlus,
+                         env)) {
+            return src;
+        }
+        hotBand.store(hint, std::memory_order_relaxed);
     }
 
     PVideoFrame alt = altc->GetFrame(n, env);
-    PVideoFrame dst = env->NewVideoFrame(vi);
+    PVideoFrame dst = env->NewVideoFrame(vi, align);
 
-    mergeFrames(numPlanes, src, alt, mask, dst);
+    static const int planes[] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+    for (int p = 0; p < numPlanes; ++p) {
+        const int plane = planes[p];
+        mergeFrames(src->GetReadPtr(plane), alt->GetReadPtr(plane),
+                    mask->GetReadPtr(plane), dst->GetWritePtr(plane),
+                    src->GetPitch(plane), alt->GetPitch(plane),
+                    mask->GetPitch(plane), dst->GetPitch(plane),
+                    src->GetRowSize(plane), src->GetHeight(plane));
+    }
 
-    if (numPlanes == 1 && !vi.IsY8()) {
+    if (numPlanes == 1 && vi.IsPlanar() && !vi.IsY8()) {
         const int src_pitch = src->GetPitch(PLANAR_U);
         const int dst_pitch = dst->GetPitch(PLANAR_U);
         const int width = src->GetRowSize(PLANAR_U);
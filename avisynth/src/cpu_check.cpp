@@ -21,7 +21,16 @@
 */
 
 #include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || \
+        defined(_M_IX86)
+
+#if defined(_MSC_VER)
 #include <intrin.h>
+#else
+#include <cpuid.h>
+#define __forceinline inline __attribute__((always_inline))
+#endif
 
 
 enum {
@@ -55,12 +64,26 @@ static __forceinline bool is_bit_set(int bitfield, int bit)
     return (bitfield & (1 << bit)) != 0;
 }
 
+static void cpuid(int* regs, int leaf, int subleaf = 0)
+{
+#if defined(_MSC_VER)
+    __cpuidex(regs, leaf, subleaf);
+#else
+    unsigned a, b, c, d;
+    __cpuid_count(leaf, subleaf, a, b, c, d);
+    regs[0] = a;
+    regs[1] = b;
+    regs[2] = c;
+    regs[3] = d;
+#endif
+}
+
 static uint32_t get_simd_support_info(void)
 {
     uint32_t ret = 0;
     int regs[4] = {0};
 
-    __cpuid(regs, 0x00000001);
+    cpuid(regs, 0x00000001);
     if (is_bit_set(regs[3], 26)) {
         ret |= CPU_SSE2_SUPPORT;
     }
@@ -86,7 +109,7 @@ static uint32_t get_simd_support_info(void)
     }
 
     regs[3] = 0;
-    __cpuid(regs, 0x80000001);
+    cpuid(regs, 0x80000001);
     if (is_bit_set(regs[3], 6)) {
         ret |= CPU_SSE4_A_SUPPORT;
     }
@@ -94,12 +117,12 @@ static uint32_t get_simd_support_info(void)
         ret |= CPU_FMA4_SUPPORT;
     }
 
-    __cpuid(regs, 0x00000000);
+    cpuid(regs, 0x00000000);
     if (regs[0] < 7) {
         return ret;
     }
 
-    __cpuidex(regs, 0x00000007, 0);
+    cpuid(regs, 0x00000007, 0);
     if (is_bit_set(regs[1], 5)) {
         ret |= CPU_AVX2_SUPPORT;
     }
@@ -145,3 +168,29 @@ bool has_avx2()
 {
     return (get_simd_support_info() & CPU_AVX2_SUPPORT) != 0;
 }
+
+bool has_avx512()
+{
+    const uint32_t flags = CPU_AVX512F_SUPPORT | CPU_AVX512BW_SUPPORT;
+    return (get_simd_support_info() & flags) == flags;
+}
+
+#else
+
+// no x86 SIMD on the other architectures.
+bool has_sse2()
+{
+    return false;
+}
+
+bool has_avx2()
+{
+    return false;
+}
+
+bool has_avx512()
+{
+    return false;
+}
+
+#endif
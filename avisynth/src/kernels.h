@@ -0,0 +1,1046 @@
+/*
+  CombMask for AviSynth2.6x
+
+  Copyright (C) 2013 Oka Motofumi
+
+  Authors: Oka Motofumi (chikuzen.mo at gmail dot com)
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+*/
+
+
+/*
+SIMD routines of CombMask and MaskedMerge, written once as templates on the
+vector type. kernels_sse2.cpp, kernels_avx2.cpp and kernels_avx512.cpp include
+this file and are compiled with the matching /arch option, so a single binary
+has all of them and get_arch() picks one at runtime.
+Everything here has internal linkage, thus each of those files has its own
+copies and no code built for a newer instruction set is shared with the
+others. For the same reason, the routines don't call inline functions of the
+standard library (std::min and so on) or of avisynth.h (the members of
+PVideoFrame and VideoFrame), which the linker may share. They take the
+pointers and pitches of the planes instead of frames.
+*/
+
+
+#ifndef COMB_MASK_KERNELS_H
+#define COMB_MASK_KERNELS_H
+
+#include <cstdint>
+#include <cstring>
+#include "CombMask.h"
+#include "simd.h"
+
+
+static __forceinline int absdiff(int x, int y) noexcept
+{
+    return x > y ? x - y : y - x;
+}
+
+
+// the line y of a plane of height lines, mirrored at its edges.
+static __forceinline int mirror_line(int y, int height) noexcept
+{
+    return y < 0 ? -y : y < height ? y : 2 * (height - 1) - y;
+}
+
+
+/*
+When field is 0 or 1, the comb metric is evaluated only on the lines of that
+parity (counted from srcp). Each line of the other parity gets the mask of the
+evaluated line in the same pair.
+*/
+static void
+copy_field(uint8_t* dstp, const int dpitch, const int width, const int height,
+           const int first) noexcept
+{
+    for (int y = 1 - first; y < height; y += 2) {
+        const int from = (y ^ 1) < height ? y ^ 1 : y - 1;
+        std::memcpy(dstp + y * dpitch, dstp + from * dpitch, width);
+    }
+}
+
+
+/*
+a line of the comb mask of metric 0 (see CombMask.cpp) from the lines a to e.
+gt and lt are c - b > cthresh and c - b < -cthresh. they are replaced with
+those of d - c, which is c - b of the next line.
+*/
+template <typename V>
+static __forceinline void
+comb_line_0(uint8_t* dstl, const V& a, const V& b, const V& c, const V& d,
+            const V& e, V& gt, V& lt, const V& cthp, const V& cthn,
+            const V& cth6) noexcept
+{
+    V dc = sub_i16(d, c);
+    V gtd = cmpgt_i16(dc, cthp);
+    V ltd = cmpgt_i16(cthn, dc);
+    V mask0 = or_reg(and_reg(gt, ltd), and_reg(lt, gtd));
+    gt = gtd;
+    lt = ltd;
+
+    V d2 = mul3(add_i16(b, d));
+    V d1 = add_i16(add_i16(a, e), lshift_i16(c, 2));
+    mask0 = and_reg(mask0, cmpgt_i16(absdiff_i16(d1, d2), cth6));
+    store_half(dstl, mask0);
+}
+
+
+template <typename V>
+static __forceinline void
+comb_line_1(uint8_t* dstl, const V& b, const V& c, const V& d, const V& cth,
+            const V& all) noexcept
+{
+    V xb = sub_i16(b, c);
+    V xd = sub_i16(d, c);
+    V xc = andnot(mulhi(xb, xd), mullo(xb, xd));
+    store_half(dstl, cmpgt_u16(xc, cth, all));
+}
+
+
+// a vector of AVX-512 covers two blocks.
+template <typename V>
+static __forceinline bool skip_blocks(const uint8_t* mrow, int x) noexcept
+{
+    constexpr int step = sizeof(V) / 2;
+    return mrow && mrow[x >> 4] == 0
+        && (step <= 16 || mrow[(x >> 4) + 1] == 0);
+}
+
+
+/*
+comb_rows lines of the comb mask of metric 0 from the comb_rows + 4 lines of
+s. Each source line is loaded once for all of the lines which use it, and the
+difference of two adjacent lines is compared once for the two lines which use
+it.
+*/
+template <typename V>
+static __forceinline void
+comb_rows_0_simd(uint8_t* dstp, const int dpitch, const uint8_t* const* s,
+                 const int width, const uint8_t* mrow, const V& cthp,
+                 const V& cthn, const V& cth6) noexcept
+{
+    static_assert(comb_rows == 4, "comb_rows_0_simd makes four lines.");
+    constexpr int step = sizeof(V) / 2;
+
+    for (int x = 0; x < width; x += step) {
+        if (skip_blocks<V>(mrow, x)) {
+            continue;
+        }
+        V r0 = load_half<V>(s[0] + x);
+        V r1 = load_half<V>(s[1] + x);
+        V r2 = load_half<V>(s[2] + x);
+        V r3 = load_half<V>(s[3] + x);
+        V r4 = load_half<V>(s[4] + x);
+        V cb = sub_i16(r2, r1);
+        V gt = cmpgt_i16(cb, cthp);
+        V lt = cmpgt_i16(cthn, cb);
+        comb_line_0(dstp + x, r0, r1, r2, r3, r4, gt, lt, cthp, cthn, cth6);
+        V r5 = load_half<V>(s[5] + x);
+        comb_line_0(dstp + dpitch + x, r1, r2, r3, r4, r5, gt, lt, cthp,
+                    cthn, cth6);
+        V r6 = load_half<V>(s[6] + x);
+        comb_line_0(dstp + dpitch * 2 + x, r2, r3, r4, r5, r6, gt, lt, cthp,
+                    cthn, cth6);
+        V r7 = load_half<V>(s[7] + x);
+        comb_line_0(dstp + dpitch * 3 + x, r3, r4, r5, r6, r7, gt, lt, cthp,
+                    cthn, cth6);
+    }
+}
+
+
+template <typename V>
+static __forceinline void
+comb_row_0_simd(uint8_t* dstl, const uint8_t* const* s, const int width,
+                const uint8_t* mrow, const V& cthp, const V& cthn,
+                const V& cth6) noexcept
+{
+    constexpr int step = sizeof(V) / 2;
+
+    for (int x = 0; x < width; x += step) {
+        if (skip_blocks<V>(mrow, x)) {
+            continue;
+        }
+        V r1 = load_half<V>(s[1] + x);
+        V r2 = load_half<V>(s[2] + x);
+        V cb = sub_i16(r2, r1);
+        V gt = cmpgt_i16(cb, cthp);
+        V lt = cmpgt_i16(cthn, cb);
+        comb_line_0(dstl + x, load_half<V>(s[0] + x), r1, r2,
+                    load_half<V>(s[3] + x), load_half<V>(s[4] + x), gt, lt,
+                    cthp, cthn, cth6);
+    }
+}
+
+
+// comb_rows lines of the comb mask of metric 1 from comb_rows + 2 lines of s.
+template <typename V>
+static __forceinline void
+comb_rows_1_simd(uint8_t* dstp, const int dpitch, const uint8_t* const* s,
+                 const int width, const uint8_t* mrow, const V& cth,
+                 const V& all) noexcept
+{
+    static_assert(comb_rows == 4, "comb_rows_1_simd makes four lines.");
+    constexpr int step = sizeof(V) / 2;
+
+    for (int x = 0; x < width; x += step) {
+        if (skip_blocks<V>(mrow, x)) {
+            continue;
+        }
+        V r0 = load_half<V>(s[0] + x);
+        V r1 = load_half<V>(s[1] + x);
+        V r2 = load_half<V>(s[2] + x);
+        comb_line_1(dstp + x, r0, r1, r2, cth, all);
+        V r3 = load_half<V>(s[3] + x);
+        comb_line_1(dstp + dpitch + x, r1, r2, r3, cth, all);
+        V r4 = load_half<V>(s[4] + x);
+        comb_line_1(dstp + dpitch * 2 + x, r2, r3, r4, cth, all);
+        V r5 = load_half<V>(s[5] + x);
+        comb_line_1(dstp + dpitch * 3 + x, r3, r4, r5, cth, all);
+    }
+}
+
+
+template <typename V>
+static __forceinline void
+comb_row_1_simd(uint8_t* dstl, const uint8_t* const* s, const int width,
+                const uint8_t* mrow, const V& cth, const V& all) noexcept
+{
+    constexpr int step = sizeof(V) / 2;
+
+    for (int x = 0; x < width; x += step) {
+        if (skip_blocks<V>(mrow, x)) {
+            continue;
+        }
+        comb_line_1(dstl + x, load_half<V>(s[0] + x), load_half<V>(s[1] + x),
+                    load_half<V>(s[2] + x), cth, all);
+    }
+}
+
+
+// see comb_lines_t. a full group of comb_rows lines is made at once.
+template <typename V>
+static __forceinline void
+comb_lines_0_simd(uint8_t* dstp, const int dpitch, const uint8_t* srcp,
+                  const int spitch, const int cthresh, const int width,
+                  const int height, const int y, const int rows,
+                  const uint8_t* mrow) noexcept
+{
+    int16_t cth16 = static_cast<int16_t>(cthresh);
+    const V cthp = set1_i16<V>(cth16);
+    const V cthn = set1_i16<V>(-cth16);
+    const V cth6 = set1_i16<V>(cth16 * 6);
+
+    const uint8_t* s[comb_rows + 4];
+    for (int i = 0; i < rows + 4; ++i) {
+        s[i] = srcp + mirror_line(y - 2 + i, height) * spitch;
+    }
+    if (rows == comb_rows) {
+        comb_rows_0_simd<V>(dstp, dpitch, s, width, mrow, cthp, cthn, cth6);
+        return;
+    }
+    for (int i = 0; i < rows; ++i) {
+        comb_row_0_simd<V>(dstp + i * dpitch, s + i, width, mrow, cthp, cthn,
+                           cth6);
+    }
+}
+
+
+template <typename V>
+static __forceinline void
+comb_lines_1_simd(uint8_t* dstp, const int dpitch, const uint8_t* srcp,
+                  const int spitch, const int cthresh, const int width,
+                  const int height, const int y, const int rows,
+                  const uint8_t* mrow) noexcept
+{
+    const V cth = set1_i16<V>(static_cast<int16_t>(cthresh));
+    const V all = cmpeq_i8(cth, cth);
+
+    const uint8_t* s[comb_rows + 2];
+    for (int i = 0; i < rows + 2; ++i) {
+        s[i] = srcp + mirror_line(y - 1 + i, height) * spitch;
+    }
+    if (rows == comb_rows) {
+        comb_rows_1_simd<V>(dstp, dpitch, s, width, mrow, cth, all);
+        return;
+    }
+    for (int i = 0; i < rows; ++i) {
+        comb_row_1_simd<V>(dstp + i * dpitch, s + i, width, mrow, cth, all);
+    }
+}
+
+
+/*
+The motion stage also records which 16x16 blocks of the plane have any
+motion at all. The final mask is (comb & motion), so the comb metric of a
+block without motion never reaches the output and the comb pass skips it.
+*/
+template <typename V>
+static __forceinline void mark_blocks(uint8_t* mrow, const V& x) noexcept
+{
+    const uint64_t m = movemask(x);
+    for (int i = 0; i < static_cast<int>(sizeof(V)) / 16; ++i) {
+        mrow[i] |= static_cast<uint8_t>(((m >> (i * 16)) & 0xFFFF) != 0);
+    }
+}
+
+
+template <typename V>
+static void
+dilate_motion_simd(uint8_t* dstp, uint8_t* mapp, const uint8_t* tmpp,
+                   const int dpitch, const int tpitch, const int mpitch,
+                   const int width, const int height) noexcept
+{
+    const uint8_t* t0 = tmpp;
+    const uint8_t* t1 = tmpp;
+    const uint8_t* t2 = tmpp + tpitch;
+
+    std::memset(mapp, 0, mpitch * ((height + 15) >> 4));
+
+    for (int y = 0; y < height; ++y) {
+        uint8_t* mrow = mapp + (y >> 4) * mpitch;
+        for (int x = 0; x < width; x += sizeof(V)) {
+            V dst = or_reg(load<V>(t0 + x), load<V>(t1 + x));
+            dst = or_reg(dst, load<V>(t2 + x));
+            store(dstp + x, dst);
+            mark_blocks(mrow + (x >> 4), dst);
+        }
+        t0 = t1;
+        t1 = t2;
+        if (y < height - 2) {
+            t2 += tpitch;
+        }
+        dstp += dpitch;
+    }
+}
+
+
+template <typename V>
+static void __stdcall
+motion_mask_simd(uint8_t** tmpp, uint8_t** dstp, const uint8_t** srcp,
+                 const int tpitch, const int* dpitch, const int* spitch,
+                 const int mthresh, const int width, const int height,
+                 uint8_t** mapp, const int mpitch, const int count) noexcept
+{
+    const V mth = set1_i8<V>(static_cast<int8_t>(mthresh));
+    const V all = cmpeq_i8(mth, mth);
+
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; x += sizeof(V)) {
+            V s0 = loadu<V>(srcp[0] + x + y * spitch[0]);
+            for (int i = 0; i < count; ++i) {
+                V s1 = loadu<V>(srcp[i + 1] + x + y * spitch[i + 1]);
+                store(tmpp[i] + x + y * tpitch,
+                      cmpgt_u8(absdiff_u8(s1, s0), mth, all));
+                s0 = s1;
+            }
+        }
+    }
+
+    for (int i = 0; i < count; ++i) {
+        dilate_motion_simd<V>(dstp[i], mapp[i], tmpp[i], dpitch[i], tpitch,
+                              mpitch, width, height);
+    }
+}
+
+
+template <typename V>
+static void __stdcall
+and_masks_simd(uint8_t* dstp, const uint8_t* altp, const int dpitch,
+               const int apitch, const int width, const int height) noexcept
+{
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; x += sizeof(V)) {
+            V d = load<V>(dstp + x);
+            V a = load<V>(altp + x);
+            store(dstp + x, and_reg(d, a));
+        }
+        dstp += dpitch;
+        altp += apitch;
+    }
+}
+
+
+template <typename V>
+static void __stdcall
+expand_mask_simd(uint8_t* dstp, const uint8_t* srcp, const int dpitch,
+                 const int spitch, const int width, const int height) noexcept
+{
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; x += sizeof(V)) {
+            V s0 = loadu<V>(srcp + x - 1);
+            V s1 = load<V>(srcp + x);
+            V s2 = loadu<V>(srcp + x + 1);
+            stream(dstp + x, or_reg(or_reg(s0, s1), s2));
+        }
+        srcp += spitch;
+        dstp += dpitch;
+    }
+}
+
+
+template <typename V, int STEP>
+static void __stdcall
+expand_mask_packed_simd(uint8_t* dstp, const uint8_t* srcp,
+                        const int dpitch, const int spitch, const int width,
+                        const int height) noexcept
+{
+    const V even = set1_i16<V>(0x00FF);
+
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; x += sizeof(V)) {
+            const V s = load<V>(srcp + x);
+            V d = or_reg(or_reg(loadu<V>(srcp + x - 4), s),
+                         loadu<V>(srcp + x + 4));
+            if (STEP != 4) {
+                V l = or_reg(or_reg(loadu<V>(srcp + x - STEP), s),
+                             loadu<V>(srcp + x + STEP));
+                d = blendv(d, l, even);
+            }
+            stream(dstp + x, d);
+        }
+        srcp += spitch;
+        dstp += dpitch;
+    }
+}
+
+
+// writes rows lines of the comb mask from the line y, rows lines apart by
+// dpitch. mrow is the row of the block map of the lines, or nullptr.
+typedef void (*comb_lines_t)(
+    uint8_t* dstp, const int dpitch, const uint8_t* srcp, const int spitch,
+    const int cthresh, const int width, const int height, const int y,
+    const int rows, const uint8_t* mrow);
+
+
+// the line whose comb mask is used on the line y (see copy_field).
+static __forceinline int field_line(int y, int height, int field) noexcept
+{
+    if (field < 0 || (y & 1) == field) {
+        return y;
+    }
+    return (y ^ 1) < height ? y ^ 1 : y - 1;
+}
+
+
+/*
+EXPAND_MASK reads EDGE bytes (1 on planar formats, 4 on YUY2 and RGB32) out of
+each side of the bytes it expands. At the ends of a line, the first and last
+EDGE bytes are copied out of it, which has the same effect as the repeated
+edge pixel.
+*/
+template <int EDGE>
+static __forceinline void
+pad_line(uint8_t* linep, const bool left, const bool right,
+         const int width) noexcept
+{
+    for (int i = 0; i < EDGE; ++i) {
+        if (left) {
+            linep[i - EDGE] = linep[i];
+        }
+        if (right) {
+            linep[width + i] = linep[width - EDGE + i];
+        }
+    }
+}
+
+
+/*
+expands [x0, x1) of the line m of the comb mask, which is made up to c1, into
+dstl. The 4 bytes on the left of the strip are those which the previous strip
+saved in edgep, since the motion mask there has been overwritten with its
+output. The 4 bytes on its right are saved for the next one.
+*/
+template <expand_mask_t EXPAND_MASK, int EDGE>
+static __forceinline void
+expand_strip(uint8_t* dstl, uint8_t* m, uint8_t* edgep, const int dpitch,
+             const int bpitch, const int x0, const int x1, const int c1,
+             const int width) noexcept
+{
+    if (x0 > 0) {
+        std::memcpy(m + x0 - 4, edgep, 4);
+    }
+    if (x1 < width) {
+        std::memcpy(edgep, m + x1 - 4, 4);
+    }
+    pad_line<EDGE>(m, x0 == 0, c1 == width, width);
+    EXPAND_MASK(dstl + x0, m + x0, dpitch, bpitch, x1 - x0, 1);
+}
+
+
+// comb_pipeline on the columns [x0, x1) of the plane.
+template <comb_lines_t COMB_LINES, and_masks_t AND_MASKS,
+          expand_mask_t EXPAND_MASK, int EDGE, bool MOTION, bool EXPAND>
+static __forceinline void
+comb_strip(uint8_t* dstp, uint8_t* buffp, const uint8_t* srcp,
+           const int dpitch, const int bpitch, const int spitch,
+           const int cthresh, const int width, const int height,
+           const uint8_t* mapp, const int mpitch, const int field,
+           const int x0, const int x1) noexcept
+{
+    // the comb mask is made 4 bytes past the strip for EXPAND_MASK.
+    const int c1 = !EXPAND ? x1 : width - x1 > 4 ? x1 + 4 : width;
+    uint8_t* edgep = EXPAND ? buffp + bpitch * comb_rows : nullptr;
+    srcp += x0;
+    mapp += x0 >> 4;
+
+    if (!MOTION && !EXPAND && field >= 0) {
+        for (int y = field; y < height; y += 2) {
+            COMB_LINES(dstp + y * dpitch + x0, dpitch, srcp, spitch, cthresh,
+                       x1 - x0, height, y, 1, nullptr);
+        }
+        return;
+    }
+
+    if (field >= 0) {
+        // the skipped blocks of comb are left as is, and cleared by AND_MASKS.
+        uint8_t* comb = buffp;
+        uint8_t* line = buffp + bpitch;
+        int last = -1;
+
+        for (int y = 0; y < height; ++y) {
+            const int from = field_line(y, height, field);
+            if (from != last) {
+                COMB_LINES(comb + x0, bpitch, srcp, spitch, cthresh, c1 - x0,
+                           height, from, 1,
+                           MOTION ? mapp + (from >> 4) * mpitch : nullptr);
+                last = from;
+            }
+            uint8_t* dstl = dstp + y * dpitch;
+
+            if (!EXPAND) {
+                AND_MASKS(dstl + x0, comb + x0, dpitch, bpitch, x1 - x0, 1);
+                continue;
+            }
+            if (!MOTION) {
+                expand_strip<EXPAND_MASK, EDGE>(dstl, comb, edgep + y * 4,
+                                                dpitch, bpitch, x0, x1, c1,
+                                                width);
+                continue;
+            }
+            // comb is used by the next line too.
+            std::memcpy(line + x0, comb + x0, c1 - x0);
+            AND_MASKS(line + x0, dstl + x0, bpitch, dpitch, c1 - x0, 1);
+            expand_strip<EXPAND_MASK, EDGE>(dstl, line, edgep + y * 4, dpitch,
+                                            bpitch, x0, x1, c1, width);
+        }
+        return;
+    }
+
+    for (int y = 0; y < height; y += comb_rows) {
+        const int rows = height - y < comb_rows ? height - y : comb_rows;
+        if (!MOTION && !EXPAND) {
+            COMB_LINES(dstp + y * dpitch + x0, dpitch, srcp, spitch, cthresh,
+                       x1 - x0, height, y, rows, nullptr);
+            continue;
+        }
+
+        // the skipped blocks of buffp are left as is, and cleared by
+        // AND_MASKS.
+        COMB_LINES(buffp + x0, bpitch, srcp, spitch, cthresh, c1 - x0, height,
+                   y, rows, MOTION ? mapp + (y >> 4) * mpitch : nullptr);
+        for (int i = 0; i < rows; ++i) {
+            uint8_t* dstl = dstp + (y + i) * dpitch;
+            uint8_t* comb = buffp + i * bpitch;
+            if (!EXPAND) {
+                AND_MASKS(dstl + x0, comb + x0, dpitch, bpitch, x1 - x0, 1);
+                continue;
+            }
+            if (MOTION) {
+                AND_MASKS(comb + x0, dstl + x0, bpitch, dpitch, c1 - x0, 1);
+            }
+            expand_strip<EXPAND_MASK, EDGE>(dstl, comb, edgep + (y + i) * 4,
+                                            dpitch, bpitch, x0, x1, c1,
+                                            width);
+        }
+    }
+}
+
+
+/*
+The stages of CombMask which follow the motion pass, for a plane of a frame:
+the comb metric, AND with the motion mask already written to dstp (MOTION) and
+expand (EXPAND). Each configuration is an instantiation of its own, so the
+stages are inlined into one loop over the lines without any runtime branch on
+the configuration.
+The comb mask is made comb_rows lines at a time, which share the loads of
+their source lines, and the lines are used while they are still in L1. On
+field mode, it is made a line at a time, and each line is used for its pair.
+A plane wider than strip_width is processed in column strips of strip_width
+bytes, so that the source lines shared by the groups of lines stay in L2
+however wide the frame is.
+This is used by the C++ routines (CombMask.cpp) as well as the SIMD ones.
+*/
+template <comb_lines_t COMB_LINES, and_masks_t AND_MASKS,
+          expand_mask_t EXPAND_MASK, int EDGE, bool MOTION, bool EXPAND>
+static void __stdcall
+comb_pipeline(uint8_t* dstp, uint8_t* buffp, const uint8_t* srcp,
+              const int dpitch, const int bpitch, const int spitch,
+              const int cthresh, const int width, const int height,
+              const uint8_t* mapp, const int mpitch, const int field) noexcept
+{
+    static_assert(16 % comb_rows == 0, "a group spans one line of blocks.");
+    static_assert(strip_width % 64 == 0, "a strip starts on a block.");
+
+    for (int x0 = 0; x0 < width; x0 += strip_width) {
+        const int x1 = width - x0 > strip_width ? x0 + strip_width : width;
+        comb_strip<COMB_LINES, AND_MASKS, EXPAND_MASK, EDGE, MOTION, EXPAND>(
+            dstp, buffp, srcp, dpitch, bpitch, spitch, cthresh, width, height,
+            mapp, mpitch, field, x0, x1);
+    }
+    if (!MOTION && !EXPAND && field >= 0) {
+        copy_field(dstp, dpitch, width, height, field);
+    }
+}
+
+
+// the instantiation of comb_pipeline for mthresh > 0 (motion) and expand.
+template <comb_lines_t COMB_LINES, and_masks_t AND_MASKS,
+          expand_mask_t EXPAND_MASK, int EDGE>
+static comb_pipeline_t select_pipeline(bool motion, bool expand)
+{
+    if (motion) {
+        return expand
+            ? comb_pipeline<COMB_LINES, AND_MASKS, EXPAND_MASK, EDGE, true,
+                            true>
+            : comb_pipeline<COMB_LINES, AND_MASKS, EXPAND_MASK, EDGE, true,
+                            false>;
+    }
+    return expand
+        ? comb_pipeline<COMB_LINES, AND_MASKS, EXPAND_MASK, EDGE, false, true>
+        : comb_pipeline<COMB_LINES, AND_MASKS, EXPAND_MASK, EDGE, false,
+                        false>;
+}
+
+
+template <typename V>
+static bool __stdcall
+is_flat_simd(const uint8_t* srcp, const int pitch, const int width,
+             const int height, const int thresh) noexcept
+{
+    const V th = set1_i8<V>(static_cast<int8_t>(thresh < 255 ? thresh : 255));
+    const V zero = setzero<V>();
+    const uint64_t none = movemask(cmpeq_i8(zero, zero));
+    const int vwidth = width & ~(static_cast<int>(sizeof(V)) - 1);
+
+    for (int y = 1; y < height; ++y) {
+        const uint8_t* above = srcp;
+        srcp += pitch;
+        V over = zero;
+        for (int x = 0; x < vwidth; x += sizeof(V)) {
+            V diff = absdiff_u8(loadu<V>(above + x), loadu<V>(srcp + x));
+            over = or_reg(over, subs(diff, th));
+        }
+        if (movemask(cmpeq_i8(over, zero)) != none) {
+            return false;
+        }
+        for (int x = vwidth; x < width; ++x) {
+            if (absdiff(above[x], srcp[x]) > thresh) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+template <typename V>
+static bool __stdcall
+is_dark_simd(const uint8_t* srcp, const int pitch, const int width,
+             const int height, const int level) noexcept
+{
+    const V lv = set1_i8<V>(static_cast<int8_t>(level));
+    const V zero = setzero<V>();
+    const uint64_t none = movemask(cmpeq_i8(zero, zero));
+    const int vwidth = width & ~(static_cast<int>(sizeof(V)) - 1);
+
+    for (int y = 0; y < height; ++y) {
+        V over = zero;
+        for (int x = 0; x < vwidth; x += sizeof(V)) {
+            over = or_reg(over, subs(loadu<V>(srcp + x), lv));
+        }
+        if (movemask(cmpeq_i8(over, zero)) != none) {
+            return false;
+        }
+        for (int x = vwidth; x < width; ++x) {
+            if (srcp[x] > level) {
+                return false;
+            }
+        }
+        srcp += pitch;
+    }
+    return true;
+}
+
+
+/*
+A pixel of U/V masks made with lumachroma=true is the OR of the Y mask over its
+cell of (1 << ssw) x (1 << ssh) pixels.
+*/
+static void __stdcall
+mask_from_luma_c(uint8_t* dstp, const uint8_t* lumap, const int dpitch,
+                 const int lpitch, const int width, const int height,
+                 const int ssw, const int ssh) noexcept
+{
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            uint8_t v = 0;
+            for (int j = 0; j < 1 << ssh; ++j) {
+                for (int i = 0; i < 1 << ssw; ++i) {
+                    v |= lumap[j * lpitch + (x << ssw) + i];
+                }
+            }
+            dstp[x] = v;
+        }
+        lumap += lpitch << ssh;
+        dstp += dpitch;
+    }
+}
+
+
+template <typename V>
+static void __stdcall
+mask_from_luma_simd(uint8_t* dstp, const uint8_t* lumap, const int dpitch,
+                    const int lpitch, const int width, const int height,
+                    const int ssw, const int ssh) noexcept
+{
+    if (ssw > 1) {
+        mask_from_luma_c(dstp, lumap, dpitch, lpitch, width, height, ssw, ssh);
+        return;
+    }
+
+    const int rows = 1 << ssh;
+
+    for (int y = 0; y < height; ++y) {
+        if (ssw == 0) {
+            for (int x = 0; x < width; x += sizeof(V)) {
+                V v = load<V>(lumap + x);
+                for (int j = 1; j < rows; ++j) {
+                    v = or_reg(v, load<V>(lumap + j * lpitch + x));
+                }
+                store(dstp + x, v);
+            }
+        } else {
+            // the mask is 0 or 255, so the OR of a pair is the high byte of
+            // (w | w << 8) as a signed word.
+            for (int x = 0; x < width; x += sizeof(V) / 2) {
+                V v = load<V>(lumap + 2 * x);
+                for (int j = 1; j < rows; ++j) {
+                    v = or_reg(v, load<V>(lumap + j * lpitch + 2 * x));
+                }
+                v = rshift_i16(or_reg(v, lshift_i16(v, 8)), 8);
+                store_half(dstp + x, v);
+            }
+        }
+        lumap += lpitch * rows;
+        dstp += dpitch;
+    }
+}
+
+
+// the count of each 8 columns of BLOCKY lines, in the 64bit lanes.
+template <typename V, int BLOCKY>
+static __forceinline V
+count_columns(const uint8_t* srcp, const int pitch, const V& zero) noexcept
+{
+    // 0xFF == -1, thus the range of each bytes of sum is -32 to 0.
+    V sum = loadu<V>(srcp);
+    for (int y = 1; y < BLOCKY; ++y) {
+        sum = add_i8(sum, loadu<V>(srcp + pitch * y));
+    }
+    return sad_u8(sub_i8(zero, sum), zero);
+}
+
+
+/*
+The frame is scanned band by band (BLOCKY rows each), starting from the band
+where the previous frame was found to be combed. The counts of the blocks are
+reduced in the vector, so that the lowest 64bit lane of each block has its
+count and the others have a part of it. A part can't exceed mi unless the
+block does, thus all of the lanes are compared at once. A block of 32
+columns spans two vectors of 128bit, which are added first.
+*/
+template <typename V, int BLOCKX, int BLOCKY>
+static bool __stdcall
+check_combed_simd(const uint8_t* srcp, const int pitch, const int rowsize,
+                  const int height, int mi, int, int, int, int, int& hint,
+                  bool, ise_t*)
+{
+    constexpr int vsize = sizeof(V);
+    constexpr int step = BLOCKX > vsize ? BLOCKX : vsize;
+
+    const int width = rowsize & (~(BLOCKX - 1));
+    const int bands = height / BLOCKY;
+
+    const V zero = setzero<V>();
+    const V th = set1_i16<V>(static_cast<int16_t>(mi));
+
+    int band = hint > 0 && hint < bands ? hint : 0;
+
+    for (int i = 0; i < bands; ++i, ++band) {
+        if (band == bands) {
+            band = 0;
+        }
+        const uint8_t* s = srcp + band * BLOCKY * pitch;
+
+        for (int x = 0; x < width; x += step) {
+            V sum = count_columns<V, BLOCKY>(s + x, pitch, zero);
+            if (BLOCKX > vsize) {
+                sum = add_i64(sum, count_columns<V, BLOCKY>(s + x + vsize,
+                                                             pitch, zero));
+            }
+            if (BLOCKX >= 16) {
+                sum = add_upper_i64(sum);
+            }
+            if (BLOCKX >= 32) {
+                sum = add_upper_i128(sum);
+            }
+            uint64_t over = movemask(cmpgt_i16(sum, th));
+            // the blocks beyond width.
+            if (width - x < vsize) {
+                over &= (static_cast<uint64_t>(1) << (width - x)) - 1;
+            }
+            if (over != 0) {
+                hint = band;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+
+// LUMA_ONLY: YUY2 with chroma=false, U/V bytes of mask are ignored.
+template <typename V, bool LUMA_ONLY>
+static void __stdcall
+merge_frames_simd(const uint8_t* srcp, const uint8_t* altp,
+                  const uint8_t* mskp, uint8_t* dstp, const int spitch,
+                  const int apitch, const int mpitch, const int dpitch,
+                  const int width, const int height)
+{
+    const V even = set1_i16<V>(0x00FF);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x += sizeof(V)) {
+            const V s = loadu<V>(srcp + x);
+            const V a = loadu<V>(altp + x);
+            V m = loadu<V>(mskp + x);
+            if (LUMA_ONLY) {
+                m = and_reg(m, even);
+            }
+
+            stream(dstp + x, blendv(s, a, m));
+        }
+        srcp += spitch;
+        altp += apitch;
+        mskp += mpitch;
+        dstp += dpitch;
+    }
+}
+
+
+/*
+Blocks of any size and step, which may overlap each other.
+colsum holds the count of each column over the blocky lines of the current
+line of blocks. It is moved down by adding the lines which enter the window
+and subtracting the lines which leave it, and the count of a block is the
+difference of two prefix sums of colsum. Thus a block costs O(1) whatever
+its size, and overlapping blocks don't recount the shared pixels.
+*/
+template <typename V>
+static void
+accumulate_lines_simd(int16_t* colsum, const uint8_t* srcp, const int pitch,
+                      const int width, const int lines, const bool sub)
+{
+    constexpr int step = sizeof(V) / 2;
+    const V one = set1_i16<V>(1);
+
+    for (int y = 0; y < lines; ++y) {
+        for (int x = 0; x < width; x += step) {
+            uint8_t* c = reinterpret_cast<uint8_t*>(colsum + x);
+            const V m = and_reg(load_half<V>(srcp + x), one);
+            const V s = load<V>(c);
+            store(c, sub ? sub_i16(s, m) : add_i16(s, m));
+        }
+        srcp += pitch;
+    }
+}
+
+
+/*
+colsum of packed masks is of pixels. A YUY2 pixel counts its Y byte, which is
+the low byte of a word, and a RGB32 pixel is combed if any of B, G and R is.
+*/
+template <typename V>
+static void
+accumulate_lines_yuy2_simd(int16_t* colsum, const uint8_t* srcp,
+                           const int pitch, const int width, const int lines,
+                           const bool sub)
+{
+    constexpr int step = sizeof(V) / 2;
+    const V one = set1_i16<V>(1);
+
+    for (int y = 0; y < lines; ++y) {
+        for (int x = 0; x < width; x += step) {
+            uint8_t* c = reinterpret_cast<uint8_t*>(colsum + x);
+            const V m = and_reg(loadu<V>(srcp + 2 * x), one);
+            const V s = load<V>(c);
+            store(c, sub ? sub_i16(s, m) : add_i16(s, m));
+        }
+        srcp += pitch;
+    }
+}
+
+
+template <typename V>
+static void
+accumulate_lines_rgb32_simd(int16_t* colsum, const uint8_t* srcp,
+                            const int pitch, const int width, const int lines,
+                            const bool sub)
+{
+    constexpr int step = sizeof(V) / 2;
+    const V bgr = set1_i32<V>(0x00FFFFFF);
+    const V one = set1_i16<V>(1);
+    const V zero = setzero<V>();
+    // a vector step reads twice of V, which can be beyond the pitch.
+    const int vwidth = width & ~(step - 1);
+
+    for (int y = 0; y < lines; ++y) {
+        for (int x = 0; x < vwidth; x += step) {
+            uint8_t* c = reinterpret_cast<uint8_t*>(colsum + x);
+            // -1 for the clean pixels, thus +1 makes 0 or 1.
+            V p0 = cmpeq_i32(and_reg(loadu<V>(srcp + 4 * x), bgr), zero);
+            V p1 = cmpeq_i32(and_reg(loadu<V>(srcp + 4 * x + sizeof(V)), bgr),
+                             zero);
+            const V m = add_i16(packs_i32(p0, p1), one);
+            const V s = load<V>(c);
+            store(c, sub ? sub_i16(s, m) : add_i16(s, m));
+        }
+        for (int x = vwidth; x < width; ++x) {
+            const uint8_t* p = srcp + 4 * x;
+            const int m = (p[0] | p[1] | p[2]) & 1;
+            colsum[x] += sub ? -m : m;
+        }
+        srcp += pitch;
+    }
+}
+
+
+template <void (*ACCUMULATE)(int16_t*, const uint8_t*, const int, const int,
+                             const int, const bool), int PIXEL_SIZE>
+static bool __stdcall
+check_combed_window(const uint8_t* srcp, const int pitch, const int rowsize,
+                    const int height, int mi, int blockx, int blocky,
+                    int stepx, int stepy, int&, bool is_avsplus, ise_t* env)
+{
+    const int width = rowsize / PIXEL_SIZE;
+
+    // up to 32 columns a step on AVX-512.
+    const size_t colbytes = ((width + 31) & (~31)) * sizeof(int16_t);
+    uint8_t* buff = reinterpret_cast<uint8_t*>(alloc_buffer(
+        colbytes + (width + 1) * sizeof(int32_t), 64, is_avsplus, env));
+    int16_t* colsum = reinterpret_cast<int16_t*>(buff);
+    int32_t* prefix = reinterpret_cast<int32_t*>(buff + colbytes);
+    prefix[0] = 0;
+
+    bool combed = false;
+
+    for (int y = 0; y + blocky <= height && !combed; y += stepy) {
+        if (y == 0 || stepy >= blocky) {
+            std::memset(colsum, 0, colbytes);
+            ACCUMULATE(colsum, srcp + y * pitch, pitch, width, blocky, false);
+        } else {
+            ACCUMULATE(colsum, srcp + (y - stepy) * pitch, pitch, width,
+                       stepy, true);
+            ACCUMULATE(colsum, srcp + (y + blocky - stepy) * pitch, pitch,
+                       width, stepy, false);
+        }
+
+        for (int x = 0; x < width; ++x) {
+            prefix[x + 1] = prefix[x] + colsum[x];
+        }
+        for (int x = 0; x + blockx <= width; x += stepx) {
+            if (prefix[x + blockx] - prefix[x] > mi) {
+                combed = true;
+                break;
+            }
+        }
+    }
+
+    free_buffer(buff, is_avsplus, env);
+    return combed;
+}
+
+
+template <typename V>
+static const simd_kernels_t* get_kernels_simd()
+{
+    static const simd_kernels_t kernels = {
+        {
+            {
+                select_pipeline<comb_lines_0_simd<V>, and_masks_simd<V>,
+                                expand_mask_simd<V>, 1>,
+                select_pipeline<comb_lines_0_simd<V>, and_masks_simd<V>,
+                                expand_mask_packed_simd<V, 2>, 4>,
+                select_pipeline<comb_lines_0_simd<V>, and_masks_simd<V>,
+                                expand_mask_packed_simd<V, 4>, 4>,
+            },
+            {
+                select_pipeline<comb_lines_1_simd<V>, and_masks_simd<V>,
+                                expand_mask_simd<V>, 1>,
+                select_pipeline<comb_lines_1_simd<V>, and_masks_simd<V>,
+                                expand_mask_packed_simd<V, 2>, 4>,
+                select_pipeline<comb_lines_1_simd<V>, and_masks_simd<V>,
+                                expand_mask_packed_simd<V, 4>, 4>,
+            },
+        },
+        motion_mask_simd<V>,
+        and_masks_simd<V>,
+        {
+            expand_mask_simd<V>,
+            expand_mask_packed_simd<V, 2>,
+            expand_mask_packed_simd<V, 4>,
+        },
+        is_flat_simd<V>,
+        is_dark_simd<V>,
+        mask_from_luma_simd<V>,
+        { merge_frames_simd<V, false>, merge_frames_simd<V, true> },
+        {
+            {
+                check_combed_simd<V, 8, 8>,
+                check_combed_simd<V, 8, 16>,
+                check_combed_simd<V, 8, 32>,
+            },
+            {
+                check_combed_simd<V, 16, 8>,
+                check_combed_simd<V, 16, 16>,
+                check_combed_simd<V, 16, 32>,
+            },
+            {
+                check_combed_simd<V, 32, 8>,
+                check_combed_simd<V, 32, 16>,
+                check_combed_simd<V, 32, 32>,
+            },
+        },
+        {
+            check_combed_window<accumulate_lines_simd<V>, 1>,
+            check_combed_window<accumulate_lines_yuy2_simd<V>, 2>,
+            check_combed_window<accumulate_lines_rgb32_simd<V>, 4>,
+        },
+    };
+    return &kernels;
+}
+
+#endif
@@ -0,0 +1,12 @@
+// compiled with /arch:AVX2.
+#include "kernels.h"
+
+
+const simd_kernels_t* get_kernels_avx2()
+{
+#if defined(__AVX2__)
+    return get_kernels_simd<__m256i>();
+#else
+    return nullptr;
+#endif
+}
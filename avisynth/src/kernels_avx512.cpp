@@ -0,0 +1,13 @@
+// compiled with /arch:AVX512. older compilers which don't have it build this
+// without AVX-512, and then opt falls back to AVX2.
+#include "kernels.h"
+
+
+const simd_kernels_t* get_kernels_avx512()
+{
+#if defined(__AVX512BW__)
+    return get_kernels_simd<__m512i>();
+#else
+    return nullptr;
+#endif
+}
@@ -0,0 +1,12 @@
+// compiled for AArch64, where NEON is always available.
+#include "kernels.h"
+
+
+const simd_kernels_t* get_kernels_neon()
+{
+#if defined(SIMD_NEON)
+    return get_kernels_simd<uint8x16_t>();
+#else
+    return nullptr;
+#endif
+}
@@ -0,0 +1,11 @@
+#include "kernels.h"
+
+
+const simd_kernels_t* get_kernels_sse2()
+{
+#if defined(SIMD_SSE2)
+    return get_kernels_simd<__m128i>();
+#else
+    return nullptr;
+#endif
+}
@@ -1,29 +1,41 @@
+#include <algorithm>
 #include "CombMask.h"
 
 extern bool has_sse2();
 extern bool has_avx2();
+extern bool has_avx512();
 
 
-static arch_t get_arch(int opt, bool is_avsplus)
+static arch_t get_arch(int opt)
 {
-    if (opt == 0 || !has_sse2()) {
+    if (opt == 0) {
         return NO_SIMD;
     }
-#if !defined(__AVX2__)
-    return USE_SSE2;
-#else
-    if (opt == 1 || !has_avx2() || !is_avsplus) {
+    // AArch64 always has NEON.
+    if (get_kernels_neon()) {
+        return USE_NEON;
+    }
+    if (!has_sse2()) {
+        return NO_SIMD;
+    }
+    // the kernels of an instruction set the compiler couldn't build are null.
+    if (opt == 1 || !has_avx2() || !get_kernels_avx2()) {
         return USE_SSE2;
     }
-    return USE_AVX2;
-#endif
+    if (opt == 2 || !has_avx512() || !get_kernels_avx512()) {
+        return USE_AVX2;
+    }
+    return USE_AVX512;
 }
 
 
 static AVSValue __cdecl
 create_combmask(AVSValue args, void* user_data, ise_t* env)
 {
-    enum { CLIP, CTHRESH, MTHRESH, CHROMA, EXPAND, METRIC, OPT };
+    enum {
+        CLIP, CTHRESH, MTHRESH, CHROMA, EXPAND, METRIC, OPT, BATCH, TRUST,
+        CROPTOP, CROPBOTTOM, LETTERBOX, FIELD, LUMACHROMA
+    };
 
     PClip clip = args[CLIP].AsClip();
     int metric = args[METRIC].AsInt(0);
@@ -32,10 +44,19 @@ create_combmask(AVSValue args, void* user_data, ise_t* env)
     bool ch = args[CHROMA].AsBool(true);
     bool expand = args[EXPAND].AsBool(true);
     bool is_avsplus = env->FunctionExists("SetFilterMTMode");
-    arch_t arch = get_arch(args[OPT].AsInt(-1), is_avsplus);
+    arch_t arch = get_arch(args[OPT].AsInt(-1));
+    int batch = args[BATCH].AsInt(1);
+    int trust = args[TRUST].AsInt(0);
+    int croptop = args[CROPTOP].AsInt(0);
+    int cropbottom = args[CROPBOTTOM].AsInt(0);
+    bool letterbox = args[LETTERBOX].AsBool(false);
+    int field = args[FIELD].AsInt(-1);
+    bool lumachroma = args[LUMACHROMA].AsBool(false);
 
     try{
-        return new CombMask(clip, cth, mth, ch, arch, expand, metric, is_avsplus);
+        return new CombMask(clip, cth, mth, ch, arch, expand, metric, batch,
+                            is_avsplus, trust, croptop, cropbottom, letterbox,
+                            field, lumachroma, env);
 
     } catch (std::runtime_error& e) {
         env->ThrowError("CombMask: %s", e.what());
@@ -48,7 +69,7 @@ create_combmask(AVSValue args, void* user_data, ise_t* env)
 static AVSValue __cdecl
 create_maskedmerge(AVSValue args, void*, IScriptEnvironment* env)
 {
-    enum { BASE, ALT, MASK, MI, BLOCKX, BLOCKY, CHROMA, OPT };
+    enum { BASE, ALT, MASK, MI, BLOCKX, BLOCKY, CHROMA, OPT, STEPX, STEPY };
     try {
         validate(!args[BASE].Defined(), "base clip is not set.");
         validate(!args[ALT].Defined(), "alt clip is not set.");
@@ -61,11 +82,14 @@ create_maskedmerge(AVSValue args, void*, IScriptEnvironment* env)
         int mi = args[MI].AsInt(40);
         int bx = args[BLOCKX].AsInt(8);
         int by = args[BLOCKY].AsInt(8);
+        int sx = args[STEPX].AsInt(bx);
+        int sy = args[STEPY].AsInt(by);
         bool ch = args[CHROMA].AsBool(true);
         bool is_avsplus = env->FunctionExists("SetFilterMTMode");
-        arch_t arch = get_arch(args[OPT].AsInt(-1), is_avsplus);
+        arch_t arch = get_arch(args[OPT].AsInt(-1));
 
-        return new MaskedMerge(base, alt, mask, mi, bx, by, ch, arch, is_avsplus);
+        return new MaskedMerge(base, alt, mask, mi, bx, by, sx, sy, ch, arch,
+                               is_avsplus);
     } catch (std::runtime_error& e) {
         env->ThrowError("MaskedMerge: %s", e.what());
     }
@@ -76,7 +100,10 @@ create_maskedmerge(AVSValue args, void*, IScriptEnvironment* env)
 static AVSValue __cdecl
 create_iscombed(AVSValue args, void*, ise_t* env)
 {
-    enum { CLIP, CTHRESH, MTHRESH, MI, BLOCKX, BLOCKY, METRIC, OPT };
+    enum {
+        CLIP, CTHRESH, MTHRESH, MI, BLOCKX, BLOCKY, METRIC, OPT, APPROX, STEPX,
+        STEPY, CADENCE
+    };
     CombMask* cm = nullptr;
 
     try {
@@ -92,22 +119,65 @@ create_iscombed(AVSValue args, void*, ise_t* env)
         int mi = args[MI].AsInt(80);
         int blockx = args[BLOCKX].AsInt(16);
         int blocky = args[BLOCKY].AsInt(16);
+        int stepx = args[STEPX].AsInt(blockx);
+        int stepy = args[STEPY].AsInt(blocky);
         bool is_avsplus = env->FunctionExists("SetFilterMTMode");
-        arch_t arch = get_arch(args[OPT].AsInt(-1), is_avsplus);
-
-        validate(mi < 0 || mi > 128, "MI must be between 0 and 128.");
-        validate(blockx != 8 && blockx != 16 && blockx != 32,
-                 "blockx must be set to 8, 16 or 32.");
-        validate(blocky != 8 && blocky != 16 && blocky != 32,
-                 "blocky must be set to 8, 16 or 32.");
-
-        cm = new CombMask(clip, cth, mth, false, arch, false, metric, is_avsplus);
-
-        bool is_combed = (get_check_combed(arch))(
-            cm->GetFrame(n, env), mi, blockx, blocky, is_avsplus, env);
+        arch_t arch = get_arch(args[OPT].AsInt(-1));
+        bool approx = args[APPROX].AsBool(false);
+
+        validate_blocks(mi, blockx, blocky, stepx, stepy);
+        const int pixel_size = clip->GetVideoInfo().BytesFromPixels(1);
+
+        Cadence* cadence = nullptr;
+        if (args[CADENCE].AsBool(false)) {
+            cadence = Cadence::get(clip, cth, mth, mi, blockx, blocky, stepx,
+                                   stepy, metric, approx, env);
+            // a predicted clean frame is only verified on sampled lines.
+            if (cadence->predict(n) == 0) {
+                PVideoFrame src = clip->GetFrame(n, env);
+                PVideoFrame prev;
+                if (mth > 0) {
+                    prev = clip->GetFrame(n == 0 ? 0 : n - 1, env);
+                }
+                if (Cadence::verifyClean(src, prev, cth, mth, mi, blockx,
+                                         blocky, metric, pixel_size)) {
+                    cadence->update(n, false);
+                    return AVSValue(false);
+                }
+            }
+        }
+
+        if (approx) {
+            // a block on the lattice covers twice the width and height of
+            // the source, and a quarter of its pixels are sampled. blocks
+            // smaller than 4 (blockx/y below 8) are counted as 4.
+            int bx = std::max(blockx / 2, 4);
+            int by = std::max(blocky / 2, 4);
+            mi = mi * bx * by / (blockx * blocky);
+            stepx = std::max(stepx * bx / blockx, 1);
+            stepy = std::max(stepy * by / blocky, 1);
+            blockx = bx;
+            blocky = by;
+            clip = new Lattice(clip, arch);
+        }
+
+        cm = new CombMask(clip, cth, mth, false, arch, false, metric, 1,
+                          is_avsplus, 0, 0, 0, false, -1, false, env);
+
+        int hint = 0;
+        PVideoFrame cmask = cm->GetFrame(n, env);
+        bool is_combed = (get_check_combed(
+            arch, blockx, blocky, stepx, stepy, approx ? 1 : pixel_size))(
+                cmask->GetReadPtr(PLANAR_Y), cmask->GetPitch(PLANAR_Y),
+                cmask->GetRowSize(PLANAR_Y), cmask->GetHeight(PLANAR_Y), mi,
+                blockx, blocky, stepx, stepy, hint, is_avsplus, env);
 
         delete cm;
 
+        if (cadence) {
+            cadence->update(n, is_combed);
+        }
+
         return AVSValue(is_combed);
 
     } catch (std::runtime_error& e) {
@@ -133,15 +203,20 @@ AvisynthPluginInit3(IScriptEnvironment* env, const AVS_Linkage* const vectors)
     AVS_linkage = vectors;
 
     env->AddFunction(
-        "CombMask", "c[cthresh]i[mthresh]i[chroma]b[expand]b[metric]i[opt]i",
+        "CombMask",
+        "c[cthresh]i[mthresh]i[chroma]b[expand]b[metric]i[opt]i[batch]i"
+        "[trust]i[croptop]i[cropbottom]i[letterbox]b[field]i"
+        "[lumachroma]b",
         create_combmask, nullptr);
     env->AddFunction(
         "MaskedMerge",
-        "[base]c[alt]c[mask]c[MI]i[blockx]i[blocky]i[chroma]b[opt]i",
+        "[base]c[alt]c[mask]c[MI]i[blockx]i[blocky]i[chroma]b[opt]i[stepx]i"
+        "[stepy]i",
         create_maskedmerge, nullptr);
     env->AddFunction(
         "IsCombed",
-        "c[cthresh]i[mthresh]i[MI]i[blockx]i[blocky]i[metric]i[opt]i",
+        "c[cthresh]i[mthresh]i[MI]i[blockx]i[blocky]i[metric]i[opt]i"
+        "[approx]b[stepx]i[stepy]i[cadence]b",
         create_iscombed, nullptr);
 
     return "CombMask filter for Avisynth2.6/Avisynth+ version " CMASK_VERSION;
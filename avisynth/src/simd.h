@@ -3,10 +3,17 @@
 
 
 #include <cstdint>
-#if defined(__AVX2__)
-    #include <immintrin.h>
-#else
-    #include <emmintrin.h>
+#if defined(__ARM_NEON) || defined(_M_ARM64)
+    #define SIMD_NEON
+    #include <arm_neon.h>
+#elif defined(__SSE2__) || defined(_M_X64) || \
+        (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define SIMD_SSE2
+    #if defined(__AVX2__)
+        #include <immintrin.h>
+    #else
+        #include <emmintrin.h>
+    #endif
 #endif
 
 #define FINLINE __forceinline
@@ -19,9 +26,13 @@ SFINLINE V load(const uint8_t* p);
 template <typename V>
 SFINLINE V loadu(const uint8_t* p);
 
+// loads 8/16 bytes as words. p doesn't have to be aligned.
 template <typename V>
 SFINLINE V load_half(const uint8_t* p);
 
+template <typename V>
+SFINLINE V set1_i32(int32_t val);
+
 template <typename V>
 SFINLINE V set1_i16(int16_t val);
 
@@ -32,6 +43,268 @@ template <typename V>
 SFINLINE V setzero();
 
 
+#if defined(SIMD_NEON)
+
+// the vectors are kept as bytes and reinterpreted for the operations on the
+// other lane sizes.
+#define U8(x) vreinterpretq_u8_s16(x)
+#define S16(x) vreinterpretq_s16_u8(x)
+
+template <>
+FINLINE uint8x16_t load(const uint8_t* p)
+{
+    return vld1q_u8(p);
+}
+
+template <>
+FINLINE uint8x16_t loadu(const uint8_t* p)
+{
+    return vld1q_u8(p);
+}
+
+template <>
+FINLINE uint8x16_t load_half(const uint8_t* p)
+{
+    return vreinterpretq_u8_u16(vmovl_u8(vld1_u8(p)));
+}
+
+template <>
+FINLINE uint8x16_t set1_i32(int32_t val)
+{
+    return vreinterpretq_u8_s32(vdupq_n_s32(val));
+}
+
+template <>
+FINLINE uint8x16_t set1_i16(int16_t val)
+{
+    return U8(vdupq_n_s16(val));
+}
+
+template <>
+FINLINE uint8x16_t set1_i8(int8_t val)
+{
+    return vreinterpretq_u8_s8(vdupq_n_s8(val));
+}
+
+template <>
+FINLINE uint8x16_t setzero()
+{
+    return vdupq_n_u8(0);
+}
+
+SFINLINE void store_half(uint8_t* p, const uint8x16_t& x)
+{
+    vst1_s8(reinterpret_cast<int8_t*>(p), vqmovn_s16(S16(x)));
+}
+
+SFINLINE void store_half_us(uint8_t* p, const uint8x16_t& x)
+{
+    vst1_u8(p, vqmovun_s16(S16(x)));
+}
+
+SFINLINE void store(uint8_t* p, const uint8x16_t& x)
+{
+    vst1q_u8(p, x);
+}
+
+// NEON has no non-temporal store of a vector.
+SFINLINE void stream(uint8_t* p, const uint8x16_t& x)
+{
+    vst1q_u8(p, x);
+}
+
+SFINLINE uint8x16_t add_i16(const uint8x16_t& x, const uint8x16_t& y)
+{
+    return U8(vaddq_s16(S16(x), S16(y)));
+}
+
+SFINLINE uint8x16_t add_i8(const uint8x16_t& x, const uint8x16_t& y)
+{
+    return vaddq_u8(x, y);
+}
+
+SFINLINE uint8x16_t add_i64(const uint8x16_t& x, const uint8x16_t& y)
+{
+    return vreinterpretq_u8_u64(
+        vaddq_u64(vreinterpretq_u64_u8(x), vreinterpretq_u64_u8(y)));
+}
+
+SFINLINE uint8x16_t sub_i16(const uint8x16_t& x, const uint8x16_t& y)
+{
+    return U8(vsubq_s16(S16(x), S16(y)));
+}
+
+SFINLINE uint8x16_t sub_i8(const uint8x16_t& x, const uint8x16_t& y)
+{
+    return vsubq_u8(x, y);
+}
+
+SFINLINE uint8x16_t packus_i16(const uint8x16_t& x, const uint8x16_t& y)
+{
+    return vcombine_u8(vqmovun_s16(S16(x)), vqmovun_s16(S16(y)));
+}
+
+SFINLINE uint8x16_t packs_i32(const uint8x16_t& x, const uint8x16_t& y)
+{
+    return U8(vcombine_s16(vqmovn_s32(vreinterpretq_s32_u8(x)),
+                           vqmovn_s32(vreinterpretq_s32_u8(y))));
+}
+
+SFINLINE uint8x16_t subs(const uint8x16_t& x, const uint8x16_t& y)
+{
+    return vqsubq_u8(x, y);
+}
+
+SFINLINE uint8x16_t mullo(const uint8x16_t& x, const uint8x16_t& y)
+{
+    return U8(vmulq_s16(S16(x), S16(y)));
+}
+
+// the upper halves of the 32bit products are the odd words.
+SFINLINE uint8x16_t mulhi(const uint8x16_t& x, const uint8x16_t& y)
+{
+    const int16x8_t a = S16(x);
+    const int16x8_t b = S16(y);
+    const int32x4_t lo = vmull_s16(vget_low_s16(a), vget_low_s16(b));
+    const int32x4_t hi = vmull_high_s16(a, b);
+    return U8(vuzp2q_s16(vreinterpretq_s16_s32(lo),
+                         vreinterpretq_s16_s32(hi)));
+}
+
+SFINLINE uint8x16_t or_reg(const uint8x16_t& x, const uint8x16_t& y)
+{
+    return vorrq_u8(x, y);
+}
+
+SFINLINE uint8x16_t xor_reg(const uint8x16_t& x, const uint8x16_t& y)
+{
+    return veorq_u8(x, y);
+}
+
+SFINLINE uint8x16_t and_reg(const uint8x16_t& x, const uint8x16_t& y)
+{
+    return vandq_u8(x, y);
+}
+
+SFINLINE uint8x16_t andnot(const uint8x16_t& x, const uint8x16_t& y)
+{
+    return vbicq_u8(y, x);
+}
+
+SFINLINE uint8x16_t min_i16(const uint8x16_t& x, const uint8x16_t& y)
+{
+    return U8(vminq_s16(S16(x), S16(y)));
+}
+
+SFINLINE uint8x16_t min_u16(const uint8x16_t& x, const uint8x16_t& y)
+{
+    return vreinterpretq_u8_u16(
+        vminq_u16(vreinterpretq_u16_u8(x), vreinterpretq_u16_u8(y)));
+}
+
+SFINLINE uint8x16_t min_u8(const uint8x16_t& x, const uint8x16_t& y)
+{
+    return vminq_u8(x, y);
+}
+
+SFINLINE uint8x16_t max_i16(const uint8x16_t& x, const uint8x16_t& y)
+{
+    return U8(vmaxq_s16(S16(x), S16(y)));
+}
+
+SFINLINE uint8x16_t max_u16(const uint8x16_t& x, const uint8x16_t& y)
+{
+    return vreinterpretq_u8_u16(
+        vmaxq_u16(vreinterpretq_u16_u8(x), vreinterpretq_u16_u8(y)));
+}
+
+SFINLINE uint8x16_t max_u8(const uint8x16_t& x, const uint8x16_t& y)
+{
+    return vmaxq_u8(x, y);
+}
+
+SFINLINE uint8x16_t cmpeq_i8(const uint8x16_t& x, const uint8x16_t& y)
+{
+    return vceqq_u8(x, y);
+}
+
+SFINLINE uint8x16_t cmpeq_i16(const uint8x16_t& x, const uint8x16_t& y)
+{
+    return vreinterpretq_u8_u16(
+        vceqq_u16(vreinterpretq_u16_u8(x), vreinterpretq_u16_u8(y)));
+}
+
+SFINLINE uint8x16_t cmpeq_i32(const uint8x16_t& x, const uint8x16_t& y)
+{
+    return vreinterpretq_u8_u32(
+        vceqq_u32(vreinterpretq_u32_u8(x), vreinterpretq_u32_u8(y)));
+}
+
+SFINLINE uint8x16_t cmpgt_i16(const uint8x16_t& x, const uint8x16_t& y)
+{
+    return vreinterpretq_u8_u16(vcgtq_s16(S16(x), S16(y)));
+}
+
+SFINLINE uint8x16_t absdiff_i16(const uint8x16_t& x, const uint8x16_t& y)
+{
+    return U8(vabsq_s16(vsubq_s16(S16(x), S16(y))));
+}
+
+// the shift counts of vshlq are vectors, and negative ones shift right.
+SFINLINE uint8x16_t lshift_i16(const uint8x16_t& x, int n)
+{
+    return U8(vshlq_s16(S16(x), vdupq_n_s16(static_cast<int16_t>(n))));
+}
+
+SFINLINE uint8x16_t rshift_i16(const uint8x16_t& x, int n)
+{
+    return U8(vshlq_s16(S16(x), vdupq_n_s16(static_cast<int16_t>(-n))));
+}
+
+SFINLINE uint8x16_t sad_u8(const uint8x16_t& x, const uint8x16_t& y)
+{
+    return vreinterpretq_u8_u64(
+        vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(vabdq_u8(x, y)))));
+}
+
+SFINLINE uint8x16_t blendv(const uint8x16_t& x, const uint8x16_t& y,
+                           const uint8x16_t& m)
+{
+    return vbslq_u8(m, y, x);
+}
+
+// the sign bits are weighted by their positions and summed per half.
+SFINLINE uint32_t movemask(const uint8x16_t& x)
+{
+    static const uint8_t weights[16] = {
+        1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128
+    };
+    const uint8x16_t sign = vreinterpretq_u8_s8(
+        vshrq_n_s8(vreinterpretq_s8_u8(x), 7));
+    const uint8x16_t t = vandq_u8(sign, vld1q_u8(weights));
+    return static_cast<uint32_t>(vaddv_u8(vget_low_u8(t)))
+        | (static_cast<uint32_t>(vaddv_u8(vget_high_u8(t))) << 8);
+}
+
+// adds the upper 64bit lane to the lower one.
+SFINLINE uint8x16_t add_upper_i64(const uint8x16_t& x)
+{
+    return vreinterpretq_u8_u64(vaddq_u64(
+        vreinterpretq_u64_u8(x),
+        vreinterpretq_u64_u8(vextq_u8(x, vdupq_n_u8(0), 8))));
+}
+
+// a vector of 128bit has no upper 128bit lane.
+SFINLINE uint8x16_t add_upper_i128(const uint8x16_t& x)
+{
+    return x;
+}
+
+#undef U8
+#undef S16
+
+#elif defined(SIMD_SSE2)
+
 
 template <>
 FINLINE __m128i load(const uint8_t* p)
@@ -52,6 +325,12 @@ FINLINE __m128i load_half(const uint8_t* p)
     return _mm_unpacklo_epi8(t, _mm_setzero_si128());
 }
 
+template <>
+FINLINE __m128i set1_i32(int32_t val)
+{
+    return _mm_set1_epi32(val);
+}
+
 template <>
 FINLINE __m128i set1_i16(int16_t val)
 {
@@ -102,6 +381,11 @@ SFINLINE __m128i add_i8(const __m128i& x, const __m128i& y)
     return _mm_add_epi8(x, y);
 }
 
+SFINLINE __m128i add_i64(const __m128i& x, const __m128i& y)
+{
+    return _mm_add_epi64(x, y);
+}
+
 SFINLINE __m128i sub_i16(const __m128i& x, const __m128i& y)
 {
     return _mm_sub_epi16(x, y);
@@ -112,6 +396,16 @@ SFINLINE __m128i sub_i8(const __m128i& x, const __m128i& y)
     return _mm_sub_epi8(x, y);
 }
 
+SFINLINE __m128i packus_i16(const __m128i& x, const __m128i& y)
+{
+    return _mm_packus_epi16(x, y);
+}
+
+SFINLINE __m128i packs_i32(const __m128i& x, const __m128i& y)
+{
+    return _mm_packs_epi32(x, y);
+}
+
 SFINLINE __m128i subs(const __m128i& x, const __m128i& y)
 {
     return _mm_subs_epu8(x, y);
@@ -187,6 +481,11 @@ SFINLINE __m128i cmpeq_i16(const __m128i& x, const __m128i& y)
     return _mm_cmpeq_epi16(x, y);
 }
 
+SFINLINE __m128i cmpeq_i32(const __m128i& x, const __m128i& y)
+{
+    return _mm_cmpeq_epi32(x, y);
+}
+
 SFINLINE __m128i cmpgt_i16(const __m128i& x, const __m128i& y)
 {
     return _mm_cmpgt_epi16(x, y);
@@ -202,6 +501,11 @@ SFINLINE __m128i lshift_i16(const __m128i& x, int n)
     return _mm_slli_epi16(x, n);
 }
 
+SFINLINE __m128i rshift_i16(const __m128i& x, int n)
+{
+    return _mm_srai_epi16(x, n);
+}
+
 SFINLINE __m128i sad_u8(const __m128i& x, const __m128i& y)
 {
     return _mm_sad_epu8(x, y);
@@ -212,7 +516,26 @@ SFINLINE __m128i blendv(const __m128i& x, const __m128i& y, const __m128i& m)
     return or_reg(and_reg(m, y), andnot(m, x));
 }
 
-#if defined(__AVX2__)
+SFINLINE uint32_t movemask(const __m128i& x)
+{
+    return static_cast<uint32_t>(_mm_movemask_epi8(x));
+}
+
+// adds the upper 64bit lane to the lower one.
+SFINLINE __m128i add_upper_i64(const __m128i& x)
+{
+    return _mm_add_epi64(x, _mm_srli_si128(x, 8));
+}
+
+// a vector of 128bit has no upper 128bit lane.
+SFINLINE __m128i add_upper_i128(const __m128i& x)
+{
+    return x;
+}
+
+#endif
+
+#if defined(SIMD_SSE2) && defined(__AVX2__)
 
 template <>
 FINLINE __m256i load(const uint8_t* p)
@@ -229,10 +552,16 @@ FINLINE __m256i loadu(const uint8_t* p)
 template <>
 FINLINE __m256i load_half(const uint8_t* p)
 {
-    __m128i t = _mm_load_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i t = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
     return _mm256_cvtepu8_epi16(t);
 }
 
+template <>
+FINLINE __m256i set1_i32(int32_t val)
+{
+    return _mm256_set1_epi32(val);
+}
+
 template <>
 FINLINE __m256i set1_i16(int16_t val)
 {
@@ -277,6 +606,11 @@ SFINLINE __m256i add_i8(const __m256i& x, const __m256i& y)
     return _mm256_add_epi8(x, y);
 }
 
+SFINLINE __m256i add_i64(const __m256i& x, const __m256i& y)
+{
+    return _mm256_add_epi64(x, y);
+}
+
 SFINLINE __m256i sub_i16(const __m256i& x, const __m256i& y)
 {
     return _mm256_sub_epi16(x, y);
@@ -292,6 +626,12 @@ SFINLINE __m256i subs(const __m256i& x, const __m256i& y)
     return _mm256_subs_epu8(x, y);
 }
 
+// packs across the 128bit lanes, thus the order of the words is kept.
+SFINLINE __m256i packs_i32(const __m256i& x, const __m256i& y)
+{
+    return _mm256_permute4x64_epi64(_mm256_packs_epi32(x, y), 0xD8);
+}
+
 SFINLINE __m256i mullo(const __m256i& x, const __m256i& y)
 {
     return _mm256_mullo_epi16(x, y);
@@ -367,6 +707,11 @@ SFINLINE __m256i cmpeq_i16(const __m256i& x, const __m256i& y)
     return _mm256_cmpeq_epi16(x, y);
 }
 
+SFINLINE __m256i cmpeq_i32(const __m256i& x, const __m256i& y)
+{
+    return _mm256_cmpeq_epi32(x, y);
+}
+
 SFINLINE __m256i absdiff_i16(const __m256i& x, const __m256i& y)
 {
     return _mm256_abs_epi16(sub_i16(x, y));
@@ -377,6 +722,11 @@ SFINLINE __m256i lshift_i16(const __m256i& x, int n)
     return _mm256_slli_epi16(x, n);
 }
 
+SFINLINE __m256i rshift_i16(const __m256i& x, int n)
+{
+    return _mm256_srai_epi16(x, n);
+}
+
 SFINLINE __m256i sad_u8(const __m256i& x, const __m256i& y)
 {
     return _mm256_sad_epu8(x, y);
@@ -386,6 +736,246 @@ SFINLINE __m256i blendv(const __m256i& x, const __m256i& y, const __m256i& m)
 {
     return _mm256_blendv_epi8(x, y, m);
 }
+
+SFINLINE uint32_t movemask(const __m256i& x)
+{
+    return static_cast<uint32_t>(_mm256_movemask_epi8(x));
+}
+
+// adds the upper 64bit lane of each 128bit lane to the lower one.
+SFINLINE __m256i add_upper_i64(const __m256i& x)
+{
+    return _mm256_add_epi64(x, _mm256_srli_si256(x, 8));
+}
+
+// adds the upper 128bit lane to the lower one.
+SFINLINE __m256i add_upper_i128(const __m256i& x)
+{
+    return _mm256_add_epi64(x, _mm256_permute2x128_si256(x, x, 0x81));
+}
+#endif
+
+#if defined(SIMD_SSE2) && defined(__AVX512BW__)
+
+template <>
+FINLINE __m512i load(const uint8_t* p)
+{
+    return _mm512_load_si512(reinterpret_cast<const __m512i*>(p));
+}
+
+template<>
+FINLINE __m512i loadu(const uint8_t* p)
+{
+    return _mm512_loadu_si512(reinterpret_cast<const __m512i*>(p));
+}
+
+template <>
+FINLINE __m512i load_half(const uint8_t* p)
+{
+    __m256i t = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    return _mm512_cvtepu8_epi16(t);
+}
+
+template <>
+FINLINE __m512i set1_i32(int32_t val)
+{
+    return _mm512_set1_epi32(val);
+}
+
+template <>
+FINLINE __m512i set1_i16(int16_t val)
+{
+    return _mm512_set1_epi16(val);
+}
+
+template <>
+FINLINE __m512i set1_i8(int8_t val)
+{
+    return _mm512_set1_epi8(val);
+}
+
+template <>
+FINLINE __m512i setzero()
+{
+    return _mm512_setzero_si512();
+}
+
+SFINLINE void store_half(uint8_t* p, const __m512i& x)
+{
+    __m256i t = _mm512_cvtsepi16_epi8(x);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(p), t);
+}
+
+SFINLINE void store(uint8_t* p, const __m512i& x)
+{
+    _mm512_store_si512(reinterpret_cast<__m512i*>(p), x);
+}
+
+SFINLINE void stream(uint8_t* p, const __m512i& x)
+{
+    _mm512_stream_si512(reinterpret_cast<__m512i*>(p), x);
+}
+
+SFINLINE __m512i add_i16(const __m512i& x, const __m512i& y)
+{
+    return _mm512_add_epi16(x, y);
+}
+
+SFINLINE __m512i add_i8(const __m512i& x, const __m512i& y)
+{
+    return _mm512_add_epi8(x, y);
+}
+
+SFINLINE __m512i add_i64(const __m512i& x, const __m512i& y)
+{
+    return _mm512_add_epi64(x, y);
+}
+
+SFINLINE __m512i sub_i16(const __m512i& x, const __m512i& y)
+{
+    return _mm512_sub_epi16(x, y);
+}
+
+SFINLINE __m512i sub_i8(const __m512i& x, const __m512i& y)
+{
+    return _mm512_sub_epi8(x, y);
+}
+
+SFINLINE __m512i subs(const __m512i& x, const __m512i& y)
+{
+    return _mm512_subs_epu8(x, y);
+}
+
+// packs across the 128bit lanes, thus the order of the words is kept.
+SFINLINE __m512i packs_i32(const __m512i& x, const __m512i& y)
+{
+    const __m512i idx = _mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7);
+    return _mm512_permutexvar_epi64(idx, _mm512_packs_epi32(x, y));
+}
+
+SFINLINE __m512i mullo(const __m512i& x, const __m512i& y)
+{
+    return _mm512_mullo_epi16(x, y);
+}
+
+SFINLINE __m512i mulhi(const __m512i& x, const __m512i& y)
+{
+    return _mm512_mulhi_epi16(x, y);
+}
+
+SFINLINE __m512i or_reg(const __m512i& x, const __m512i& y)
+{
+    return _mm512_or_si512(x, y);
+}
+
+SFINLINE __m512i xor_reg(const __m512i& x, const __m512i& y)
+{
+    return _mm512_xor_si512(x, y);
+}
+
+SFINLINE __m512i and_reg(const __m512i& x, const __m512i& y)
+{
+    return _mm512_and_si512(x, y);
+}
+
+SFINLINE __m512i andnot(const __m512i& x, const __m512i& y)
+{
+    return _mm512_andnot_si512(x, y);
+}
+
+SFINLINE __m512i min_i16(const __m512i& x, const __m512i& y)
+{
+    return _mm512_min_epi16(x, y);
+}
+
+SFINLINE __m512i min_u16(const __m512i& x, const __m512i& y)
+{
+    return _mm512_min_epu16(x, y);
+}
+
+SFINLINE __m512i min_u8(const __m512i& x, const __m512i& y)
+{
+    return _mm512_min_epu8(x, y);
+}
+
+SFINLINE __m512i max_i16(const __m512i& x, const __m512i& y)
+{
+    return _mm512_max_epi16(x, y);
+}
+
+SFINLINE __m512i max_u16(const __m512i& x, const __m512i& y)
+{
+    return _mm512_max_epu16(x, y);
+}
+
+SFINLINE __m512i max_u8(const __m512i& x, const __m512i& y)
+{
+    return _mm512_max_epu8(x, y);
+}
+
+// AVX-512 compares into mask registers. these expand them to vectors as the
+// callers expect.
+SFINLINE __m512i cmpgt_i16(const __m512i& x, const __m512i& y)
+{
+    return _mm512_movm_epi16(_mm512_cmpgt_epi16_mask(x, y));
+}
+
+SFINLINE __m512i cmpeq_i8(const __m512i& x, const __m512i& y)
+{
+    return _mm512_movm_epi8(_mm512_cmpeq_epi8_mask(x, y));
+}
+
+SFINLINE __m512i cmpeq_i16(const __m512i& x, const __m512i& y)
+{
+    return _mm512_movm_epi16(_mm512_cmpeq_epi16_mask(x, y));
+}
+
+SFINLINE __m512i cmpeq_i32(const __m512i& x, const __m512i& y)
+{
+    return _mm512_maskz_set1_epi32(_mm512_cmpeq_epi32_mask(x, y), -1);
+}
+
+SFINLINE __m512i absdiff_i16(const __m512i& x, const __m512i& y)
+{
+    return _mm512_abs_epi16(sub_i16(x, y));
+}
+
+SFINLINE __m512i lshift_i16(const __m512i& x, int n)
+{
+    return _mm512_slli_epi16(x, n);
+}
+
+SFINLINE __m512i rshift_i16(const __m512i& x, int n)
+{
+    return _mm512_srai_epi16(x, n);
+}
+
+SFINLINE __m512i sad_u8(const __m512i& x, const __m512i& y)
+{
+    return _mm512_sad_epu8(x, y);
+}
+
+SFINLINE __m512i blendv(const __m512i& x, const __m512i& y, const __m512i& m)
+{
+    return _mm512_mask_blend_epi8(_mm512_movepi8_mask(m), x, y);
+}
+
+SFINLINE uint64_t movemask(const __m512i& x)
+{
+    return static_cast<uint64_t>(_mm512_movepi8_mask(x));
+}
+
+// adds the upper 64bit lane of each 128bit lane to the lower one.
+SFINLINE __m512i add_upper_i64(const __m512i& x)
+{
+    return _mm512_add_epi64(x, _mm512_bsrli_epi128(x, 8));
+}
+
+// adds the upper 128bit lane of each 256bit lane to the lower one.
+SFINLINE __m512i add_upper_i128(const __m512i& x)
+{
+    return _mm512_add_epi64(x, _mm512_maskz_shuffle_i64x2(0x33, x, x, 0xF5));
+}
 #endif
 
 
@@ -21,42 +21,71 @@
 */
 
 
-#include <emmintrin.h>
-
 #define USE_ALIGNED_MALLOC
 #include "combmask.h"
 
 
+/*
+ ORs the motion masks of the lines top, center and bottom into dst, and marks
+ the blocks of mrow which have any motion. bshift: log2 of the vectors of a
+ block.
+*/
 static void CM_FUNC_ALIGN VS_CC
-vertical_proc(__m128i *center, int width, int height, __m128i *dst)
+vertical_proc(const __m128i *top, const __m128i *center,
+              const __m128i *bottom, int width, __m128i *dst, uint8_t *mrow,
+              int bshift)
 {
-    __m128i *top = center + width;
-    __m128i *bottom = top;
-
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            __m128i xmm0 = _mm_load_si128(top + x);
-            __m128i xmm1 = _mm_load_si128(center + x);
-            __m128i xmm2 = _mm_load_si128(bottom + x);
-            xmm0 = _mm_or_si128(xmm0, xmm2);
-            xmm1 = _mm_or_si128(xmm1, xmm0);
-            _mm_store_si128(dst + x, xmm1);
-        }
-        top = center;
-        center = bottom;
-        bottom = y < height - 2 ? bottom + width : bottom - width;
-        dst += width;
+    for (int x = 0; x < width; x++) {
+        __m128i xmm0 = _mm_load_si128(top + x);
+        __m128i xmm1 = _mm_load_si128(center + x);
+        __m128i xmm2 = _mm_load_si128(bottom + x);
+        xmm0 = _mm_or_si128(xmm0, xmm2);
+        xmm1 = _mm_or_si128(xmm1, xmm0);
+        _mm_store_si128(dst + x, xmm1);
+        mrow[x >> bshift] |= _mm_movemask_epi8(xmm1) != 0;
     }
 }
 
 
+/* adds both 64-bit lanes of x to *dst. */
+static inline void
+store_sum64(uint64_t *dst, __m128i x)
+{
+    uint64_t tmp[2];
+    _mm_storeu_si128((__m128i *)tmp, x);
+    *dst += tmp[0] + tmp[1];
+}
+
+
+/* adds the 32-bit lanes of x to the 64-bit lanes of acc. */
+static inline __m128i
+add_epu32_epi64(__m128i acc, __m128i x)
+{
+    __m128i zero = _mm_setzero_si128();
+    acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(x, zero));
+    return _mm_add_epi64(acc, _mm_unpackhi_epi32(x, zero));
+}
+
+
+/*
+ The motion mask functions also sum |src - prev| and count the moving pixels
+ for _SceneChangePrev/_MotionRatio. The last vector of each line is masked
+ with rem, the number of its pixels inside the frame.
+*/
 static void CM_FUNC_ALIGN VS_CC
-write_motionmask_8bit(int mthresh, int width, int height, int stride,
-                      __m128i *maskp, __m128i *srcp, __m128i *prevp)
+write_motionmask_8bit(int mthresh, int width, int height, int stride, int rem,
+                      __m128i *maskp, __m128i *srcp, __m128i *prevp,
+                      motion_stats_t *stats)
 {
     __m128i xmth = _mm_set1_epi8((int8_t)mthresh);
     __m128i zero = _mm_setzero_si128();
     __m128i all1 = _mm_cmpeq_epi32(zero, zero);
+    __m128i one = _mm_set1_epi8(1);
+    __m128i tail = _mm_cmpgt_epi8(_mm_set1_epi8((int8_t)rem),
+                                  _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9,
+                                                10, 11, 12, 13, 14, 15));
+    __m128i xsad = zero;
+    __m128i xcnt = zero;
 
     for (int y = 0; y < height; y++) {
         for (int x = 0; x < width; x++) {
@@ -66,26 +95,58 @@ write_motionmask_8bit(int mthresh, int width, int height, int stride,
             __m128i xmm2 = _mm_max_epu8(xmm0, xmm1);
             xmm0 = _mm_min_epu8(xmm0, xmm1);
             xmm2 = _mm_subs_epu8(xmm2, xmm0);
-            xmm2 = _mm_subs_epu8(xmm2, xmth);
-            xmm2 = _mm_cmpeq_epi8(xmm2, zero);
-            xmm2 = _mm_xor_si128(xmm2, all1);
+            xmm0 = _mm_subs_epu8(xmm2, xmth);
+            xmm0 = _mm_cmpeq_epi8(xmm0, zero);
+            xmm0 = _mm_xor_si128(xmm0, all1);
 
-            _mm_store_si128(maskp + x, xmm2);
+            _mm_store_si128(maskp + x, xmm0);
+
+            if (x == width - 1) {
+                xmm2 = _mm_and_si128(xmm2, tail);
+                xmm0 = _mm_and_si128(xmm0, tail);
+            }
+            xsad = _mm_add_epi64(xsad, _mm_sad_epu8(xmm2, zero));
+            xmm0 = _mm_and_si128(xmm0, one);
+            xcnt = _mm_add_epi64(xcnt, _mm_sad_epu8(xmm0, zero));
         }
         srcp += stride;
         prevp += stride;
         maskp += width;
     }
+
+    store_sum64(&stats->sad, xsad);
+    store_sum64(&stats->moving, xcnt);
+}
+
+
+/*
+ diff and mask of 16-bit words are accumulated in 32-bit lanes (sad) and 16-bit
+ lanes (count) for a line, and moved to 64-bit lanes at the end of the line.
+*/
+static inline void
+accumulate_motion_16(__m128i diff, __m128i mask, __m128i *sad, __m128i *cnt)
+{
+    __m128i zero = _mm_setzero_si128();
+    *sad = _mm_add_epi32(*sad, _mm_add_epi32(_mm_unpacklo_epi16(diff, zero),
+                                             _mm_unpackhi_epi16(diff, zero)));
+    *cnt = _mm_add_epi16(*cnt, _mm_srli_epi16(mask, 15));
 }
 
 
 static void CM_FUNC_ALIGN VS_CC
-write_motionmask_9_10(int mthresh, int width, int height, int stride,
-                      __m128i *maskp, __m128i *srcp, __m128i *prevp)
+write_motionmask_9_10(int mthresh, int width, int height, int stride, int rem,
+                      __m128i *maskp, __m128i *srcp, __m128i *prevp,
+                      motion_stats_t *stats)
 {
     __m128i xmth = _mm_set1_epi16((int16_t)mthresh);
+    __m128i tail = _mm_cmpgt_epi16(_mm_set1_epi16((int16_t)rem),
+                                   _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7));
+    __m128i xsad = _mm_setzero_si128();
+    __m128i xcnt = _mm_setzero_si128();
 
     for (int y = 0; y < height; y++) {
+        __m128i lsad = _mm_setzero_si128();
+        __m128i lcnt = _mm_setzero_si128();
         for (int x = 0; x < width; x++) {
             __m128i xmm0 = _mm_load_si128(srcp + x);
             __m128i xmm1 = _mm_load_si128(prevp + x);
@@ -93,26 +154,45 @@ write_motionmask_9_10(int mthresh, int width, int height, int stride,
             __m128i xmm2 = _mm_max_epi16(xmm0, xmm1);
             xmm0 = _mm_min_epi16(xmm0, xmm1);
             xmm2 = _mm_sub_epi16(xmm2, xmm0);
+            xmm0 = xmm2;
             xmm2 = _mm_cmpgt_epi16(xmm2, xmth);
 
-            _mm_store_si128(maskp, xmm2);
+            _mm_store_si128(maskp + x, xmm2);
+
+            if (x == width - 1) {
+                xmm0 = _mm_and_si128(xmm0, tail);
+                xmm2 = _mm_and_si128(xmm2, tail);
+            }
+            accumulate_motion_16(xmm0, xmm2, &lsad, &lcnt);
         }
+        xsad = add_epu32_epi64(xsad, lsad);
+        xcnt = add_epu32_epi64(xcnt, _mm_madd_epi16(lcnt, _mm_set1_epi16(1)));
         srcp += stride;
         prevp += stride;
         maskp += width;
     }
+
+    store_sum64(&stats->sad, xsad);
+    store_sum64(&stats->moving, xcnt);
 }
 
 
 static void CM_FUNC_ALIGN VS_CC
-write_motionmask_16bit(int mthresh, int width, int height, int stride,
-                       __m128i *maskp, __m128i *srcp, __m128i *prevp)
+write_motionmask_16bit(int mthresh, int width, int height, int stride, int rem,
+                       __m128i *maskp, __m128i *srcp, __m128i *prevp,
+                       motion_stats_t *stats)
 {
     __m128i xmth = _mm_set1_epi16((int16_t)mthresh);
     __m128i zero = _mm_setzero_si128();
     __m128i all1 = _mm_cmpeq_epi32(zero, zero);
+    __m128i tail = _mm_cmpgt_epi16(_mm_set1_epi16((int16_t)rem),
+                                   _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7));
+    __m128i xsad = zero;
+    __m128i xcnt = zero;
 
     for (int y = 0; y < height; y++) {
+        __m128i lsad = zero;
+        __m128i lcnt = zero;
         for (int x = 0; x < width; x++) {
             __m128i xmm0 = _mm_load_si128(srcp + x);
             __m128i xmm1 = _mm_load_si128(prevp + x);
@@ -120,24 +200,54 @@ write_motionmask_16bit(int mthresh, int width, int height, int stride,
             __m128i xmm2 = MM_MAX_EPU16(xmm0, xmm1);
             xmm0 = MM_MIN_EPU16(xmm0, xmm1);
             xmm2 = _mm_subs_epu16(xmm2, xmm0);
+            xmm0 = xmm2;
             xmm2 = _mm_subs_epu16(xmm2, xmth);
             xmm2 = _mm_cmpeq_epi16(xmm2, zero);
             xmm2 = _mm_xor_si128(xmm2, all1);
 
-            _mm_store_si128(maskp, xmm2);
+            _mm_store_si128(maskp + x, xmm2);
+
+            if (x == width - 1) {
+                xmm0 = _mm_and_si128(xmm0, tail);
+                xmm2 = _mm_and_si128(xmm2, tail);
+            }
+            accumulate_motion_16(xmm0, xmm2, &lsad, &lcnt);
         }
+        xsad = add_epu32_epi64(xsad, lsad);
+        xcnt = add_epu32_epi64(xcnt, _mm_madd_epi16(lcnt, _mm_set1_epi16(1)));
         srcp += stride;
         prevp += stride;
         maskp += width;
     }
+
+    store_sum64(&stats->sad, xsad);
+    store_sum64(&stats->moving, xcnt);
 }
 
 
-static void CM_FUNC_ALIGN VS_CC
+/*
+Writes the motion mask to cmask and marks every 16x16 block which has any
+motion in bmap. write_combmask() runs after this and only evaluates the comb
+metric on the marked blocks, since (comb & motion) is zero everywhere else.
+Only the lines in roi are processed, and the blocks start at its top line.
+stats gets the sums of all processed planes.
+A plane is processed in column strips of STRIP_WIDTH vectors, and a strip line
+by line: the motion of the line y + 1 is written to a ring of three lines, and
+the mask of the line y is made from the ring. The working set is a few lines
+of a strip however wide the frame is. Returns 0 if the ring can't be
+allocated.
+*/
+static int CM_FUNC_ALIGN VS_CC
 adapt_motion_all(combmask_t *ch, const VSAPI *vsapi, const VSFrameRef *src,
-                 const VSFrameRef *prev, VSFrameRef *cmask)
+                 const VSFrameRef *prev, VSFrameRef *cmask, block_map_t *bmap,
+                 const roi_t *roi, motion_stats_t *stats)
 {
     int adjust = 16 / ch->vi->format->bytesPerSample;
+    int bshift = ch->vi->format->bytesPerSample - 1;
+    __m128i *ring = (__m128i *)_aligned_malloc(STRIP_WIDTH * 3 * 16, 16);
+    if (!ring) {
+        return 0;
+    }
 
     for (int p = 0; p < ch->vi->format->numPlanes; p++) {
         if (ch->planes[p] == 0) {
@@ -145,35 +255,93 @@ adapt_motion_all(combmask_t *ch, const VSAPI *vsapi, const VSFrameRef *src,
         }
 
         int stride = vsapi->getStride(cmask, p) / 16;
-        int width = (vsapi->getFrameWidth(cmask, p) + adjust - 1) / adjust;
-        int height = vsapi->getFrameHeight(cmask, p);
+        int pixels = vsapi->getFrameWidth(cmask, p);
+        int width = (pixels + adjust - 1) / adjust;
+        int top;
+        int height = roi_lines(roi, ch->vi->format, p, &top);
+        stats->pixels += (uint64_t)pixels * height;
+
+        __m128i *srcp = (__m128i *)vsapi->getReadPtr(src, p) + top * stride;
+        __m128i *prevp = (__m128i *)vsapi->getReadPtr(prev, p) + top * stride;
+        __m128i *cmaskp = (__m128i *)vsapi->getWritePtr(cmask, p);
+        cmaskp += top * stride;
+
+        for (int x0 = 0; x0 < width; x0 += STRIP_WIDTH) {
+            int w = width - x0 < STRIP_WIDTH ? width - x0 : STRIP_WIDTH;
+            int rem = x0 + w < width ? adjust : pixels - (width - 1) * adjust;
+            uint8_t *maprow = bmap->map[p] + (x0 >> bshift);
+
+            for (int y = 0; y < height; y++) {
+                // the lines 0 and 1 at first, and then the line y + 1.
+                for (int l = y ? y + 1 : 0; l <= y + 1 && l < height; l++) {
+                    ch->write_motionmask(ch->mthresh, w, 1, stride, rem,
+                                         ring + l % 3 * w,
+                                         srcp + l * stride + x0,
+                                         prevp + l * stride + x0, stats);
+                }
+                // the lines out of the plane are mirrored.
+                int up = y > 0 ? y - 1 : height > 1 ? 1 : 0;
+                int down = y < height - 1 ? y + 1 : height > 1 ? y - 1 : y;
+                vertical_proc(ring + up % 3 * w, ring + y % 3 * w,
+                              ring + down % 3 * w, w,
+                              cmaskp + y * stride + x0,
+                              maprow + (y >> 4) * bmap->stride[p], bshift);
+            }
+        }
+    }
+    _aligned_free(ring);
+    return 1;
+}
 
-        __m128i *mmtemp = (__m128i *)_aligned_malloc(width * height * 16 * 2, 16);
-        __m128i *mmaskp = mmtemp + width * height;
 
-        ch->write_motionmask(ch->mthresh, width, height, stride, mmtemp,
-                             (__m128i *)vsapi->getReadPtr(src, p),
-                             (__m128i *)vsapi->getReadPtr(prev, p));
-        vertical_proc(mmtemp, width, height, mmaskp);
+/*
+Sums the stats of the motion stage over the lines in roi without making the
+mask, for the flat frames which skip the other stages. Returns 0 if the line
+of the mask can't be allocated.
+*/
+static int CM_FUNC_ALIGN VS_CC
+motion_stats_all(combmask_t *ch, const VSAPI *vsapi, const VSFrameRef *src,
+                 const VSFrameRef *prev, const roi_t *roi,
+                 motion_stats_t *stats)
+{
+    int adjust = 16 / ch->vi->format->bytesPerSample;
+    __m128i *line = (__m128i *)_aligned_malloc(STRIP_WIDTH * 16, 16);
+    if (!line) {
+        return 0;
+    }
 
-        __m128i *cmaskp = (__m128i *)vsapi->getWritePtr(cmask, p);
+    for (int p = 0; p < ch->vi->format->numPlanes; p++) {
+        if (ch->planes[p] == 0) {
+            continue;
+        }
 
-        for (int y = 0; y < height; y++) {
-            for (int x = 0; x < width; x++) {
-                __m128i xmm0 = _mm_load_si128(cmaskp + x);
-                __m128i xmm1 = _mm_load_si128(mmaskp + x);
-                xmm0 = _mm_and_si128(xmm0, xmm1);
-                _mm_store_si128(cmaskp + x, xmm0);
+        int stride = vsapi->getStride(src, p) / 16;
+        int pixels = vsapi->getFrameWidth(src, p);
+        int width = (pixels + adjust - 1) / adjust;
+        int top;
+        int height = roi_lines(roi, ch->vi->format, p, &top);
+        stats->pixels += (uint64_t)pixels * height;
+
+        __m128i *srcp = (__m128i *)vsapi->getReadPtr(src, p) + top * stride;
+        __m128i *prevp = (__m128i *)vsapi->getReadPtr(prev, p) + top * stride;
+
+        for (int x0 = 0; x0 < width; x0 += STRIP_WIDTH) {
+            int w = width - x0 < STRIP_WIDTH ? width - x0 : STRIP_WIDTH;
+            int rem = x0 + w < width ? adjust : pixels - (width - 1) * adjust;
+            for (int y = 0; y < height; y++) {
+                ch->write_motionmask(ch->mthresh, w, 1, stride, rem, line,
+                                     srcp + y * stride + x0,
+                                     prevp + y * stride + x0, stats);
             }
-            cmaskp += stride;
-            mmaskp += width;
         }
-        _aligned_free(mmtemp);
     }
+    _aligned_free(line);
+    return 1;
 }
 
 
 const func_adapt_motion adapt_motion = adapt_motion_all;
+const func_motion_stats motion_stats = motion_stats_all;
 
 const func_write_motionmask write_motionmask_funcs[] = {
     write_motionmask_8bit,
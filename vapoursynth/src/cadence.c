@@ -0,0 +1,133 @@
+/*
+  cadence.c: Copyright (C) 2012-2013  Oka Motofumi
+
+  Author: Oka Motofumi (chikuzen.mo at gmail dot com)
+
+  This file is part of CombMask.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with the author; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#include <stdlib.h>
+#include "combmask.h"
+
+#define PERIOD 5
+
+/*
+ CombMask(cadence=1) records _Combed of every frame in ch->history. When the
+ last two periods (10 frames) are known and repeat with a period of 5 frames,
+ and have both combed and clean frames (as 3:2 pulldown does), the result of
+ the frame one period before is the prediction. The filter is fmUnordered
+ with cadence=1, so the history is accessed by one frame at a time.
+*/
+int VS_CC
+predict_cadence(const combmask_t *ch, int n)
+{
+    if (n < PERIOD * 2) {
+        return -1;
+    }
+    int combed = 0;
+    for (int i = n - PERIOD * 2; i < n - PERIOD; i++) {
+        if (ch->history[i] < 0 || ch->history[i] != ch->history[i + PERIOD]) {
+            return -1;
+        }
+        combed += ch->history[i];
+    }
+    if (combed == 0 || combed == PERIOD) {
+        return -1;
+    }
+    return ch->history[n - PERIOD];
+}
+
+
+static inline int
+get_pix(const uint8_t *row, int x, int bytes)
+{
+    return bytes == 1 ? row[x] : ((const uint16_t *)row)[x];
+}
+
+
+static inline int
+reflect(int y, int height)
+{
+    return y < 0 ? -y : y > height - 1 ? 2 * (height - 1) - y : y;
+}
+
+
+/*
+ Sparse check of a frame predicted to be clean: only the center line of each
+ band of blocky lines of the processed planes is evaluated with the metric
+ and the motion of CombMask. The frame fails when a blockx wide part of a
+ line has more combed pixels than the average line of a block which has mi
+ combed pixels. prev is NULL when mthresh is 0.
+*/
+int VS_CC
+verify_clean(const combmask_t *ch, const VSAPI *vsapi, const VSFrameRef *src,
+             const VSFrameRef *prev)
+{
+    int bytes = ch->vi->format->bytesPerSample;
+    int cth = ch->cthresh, cth6 = ch->cthresh * 6;
+
+    for (int p = 0; p < ch->vi->format->numPlanes; p++) {
+        if (ch->planes[p] == 0) {
+            continue;
+        }
+        int width = vsapi->getFrameWidth(src, p);
+        int height = vsapi->getFrameHeight(src, p);
+        int stride = vsapi->getStride(src, p);
+        const uint8_t *srcp = vsapi->getReadPtr(src, p);
+        const uint8_t *prevp = prev ? vsapi->getReadPtr(prev, p) : NULL;
+        if (height < 3) {
+            continue;
+        }
+
+        for (int y = ch->blocky / 2; y < height; y += ch->blocky) {
+            const uint8_t *l[5];
+            for (int i = 0; i < 5; i++) {
+                l[i] = srcp + reflect(y + i - 2, height) * stride;
+            }
+
+            for (int bx = 0; bx + ch->blockx <= width; bx += ch->blockx) {
+                int count = 0;
+                for (int x = bx; x < bx + ch->blockx; x++) {
+                    if (prevp) {
+                        int moving = 0;
+                        for (int i = 1; i < 4; i++) {
+                            int offset = l[i] - srcp;
+                            moving |= abs(get_pix(l[i], x, bytes) -
+                                          get_pix(prevp + offset, x, bytes))
+                                      > ch->mthresh;
+                        }
+                        if (!moving) {
+                            continue;
+                        }
+                    }
+                    int a = get_pix(l[0], x, bytes), b = get_pix(l[1], x, bytes);
+                    int c = get_pix(l[2], x, bytes), d = get_pix(l[3], x, bytes);
+                    int e = get_pix(l[4], x, bytes);
+                    if ((c - b > cth && c - d > cth) ||
+                        (b - c > cth && d - c > cth)) {
+                        count += abs(a + 4 * c + e - 3 * (b + d)) > cth6;
+                    }
+                }
+                if (count * ch->blocky > ch->mi) {
+                    return 0;
+                }
+            }
+        }
+    }
+    return 1;
+}
@@ -0,0 +1,272 @@
+/*
+  comb_match.c: Copyright (C) 2012-2013  Oka Motofumi
+
+  Author: Oka Motofumi (chikuzen.mo at gmail dot com)
+
+  This file is part of CombMask.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with the author; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#define USE_ALIGNED_MALLOC
+#include "combmask.h"
+
+#ifdef _MSC_VER
+#define snprintf _snprintf
+#endif
+
+/*
+ CombMatch scores the three field match candidates of each frame without
+ building the woven frames. The field of the current frame selected by field
+ is kept, and the other field comes from the previous frame (p), the current
+ frame (c) or the next frame (n). The lines of the candidate are read from
+ either frame through write_combrow(), so no frame is allocated.
+*/
+typedef struct combmatch {
+    VSNodeRef *node;
+    const VSVideoInfo *vi;
+    int plane;
+    int field;
+    int cthresh;
+    int mi;
+    int blockx;
+    int blocky;
+} combmatch_t;
+
+
+static inline int
+reflect(int y, int height)
+{
+    return y < 0 ? -y : y > height - 1 ? 2 * (height - 1) - y : y;
+}
+
+
+/*
+ counts the blocks which have more combed pixels than mi on the frame woven
+ from kept and other, and the largest number of combed pixels in a block.
+*/
+static void
+score_weave(combmatch_t *mh, const VSAPI *vsapi, const VSFrameRef *kept,
+            const VSFrameRef *other, uint8_t *maskp, uint32_t *counts,
+            int *blocks, int *mic)
+{
+    int p = mh->plane;
+    int width = vsapi->getFrameWidth(kept, p);
+    int height = vsapi->getFrameHeight(kept, p);
+    int num_blocks = width / mh->blockx;
+    int last_line = height / mh->blocky * mh->blocky;
+    const uint8_t *srcp[2] = {vsapi->getReadPtr(kept, p),
+                              vsapi->getReadPtr(other, p)};
+    int stride[2] = {vsapi->getStride(kept, p), vsapi->getStride(other, p)};
+
+    *blocks = 0;
+    *mic = 0;
+    if (height < 3) {
+        return;
+    }
+
+    memset(counts, 0, num_blocks * sizeof(uint32_t));
+    const uint8_t *lines[5];
+
+    for (int y = 0; y < last_line; y++) {
+        for (int i = 0; i < 5; i++) {
+            int r = reflect(y + i - 2, height);
+            int f = (r & 1) == mh->field; // the lines of the other field
+            lines[i] = srcp[f] + r * stride[f];
+        }
+        write_combrow(mh->cthresh, (width + 15) / 16, lines[0], lines[1],
+                      lines[2], lines[3], lines[4], maskp);
+
+        for (int i = 0; i < num_blocks; i++) {
+            const uint8_t *m = maskp + i * mh->blockx;
+            uint32_t count = 0;
+            for (int x = 0; x < mh->blockx; x++) {
+                count += m[x] & 1;
+            }
+            counts[i] += count;
+        }
+
+        if ((y + 1) % mh->blocky > 0) {
+            continue;
+        }
+        for (int i = 0; i < num_blocks; i++) {
+            *blocks += counts[i] > (uint32_t)mh->mi;
+            *mic = (int)counts[i] > *mic ? (int)counts[i] : *mic;
+            counts[i] = 0;
+        }
+    }
+}
+
+
+static const VSFrameRef * VS_CC
+get_frame_combmatch(int n, int activation_reason, void **instance_data,
+                    void **frame_data, VSFrameContext *frame_ctx, VSCore *core,
+                    const VSAPI *vsapi)
+{
+    combmatch_t *mh = (combmatch_t *)*instance_data;
+    int prev = n > 0 ? n - 1 : 0;
+    int next = n < mh->vi->numFrames - 1 ? n + 1 : n;
+
+    if (activation_reason == arInitial) {
+        vsapi->requestFrameFilter(prev, mh->node, frame_ctx);
+        vsapi->requestFrameFilter(n, mh->node, frame_ctx);
+        vsapi->requestFrameFilter(next, mh->node, frame_ctx);
+        return NULL;
+    }
+
+    if (activation_reason != arAllFramesReady) {
+        return NULL;
+    }
+
+    const VSFrameRef *src[3] = {
+        vsapi->getFrameFilter(prev, mh->node, frame_ctx),
+        vsapi->getFrameFilter(n, mh->node, frame_ctx),
+        vsapi->getFrameFilter(next, mh->node, frame_ctx)
+    };
+
+    int width = vsapi->getFrameWidth(src[1], mh->plane);
+    uint8_t *maskp = (uint8_t *)_aligned_malloc((width + 15) / 16 * 16, 16);
+    uint32_t *counts = (uint32_t *)malloc((width / mh->blockx + 1)
+                                          * sizeof(uint32_t));
+    int blocks[3], mics[3];
+
+    if (maskp && counts) {
+        for (int i = 0; i < 3; i++) {
+            score_weave(mh, vsapi, src[1], src[i], maskp, counts, blocks + i,
+                        mics + i);
+        }
+    }
+    _aligned_free(maskp);
+    free(counts);
+    vsapi->freeFrame(src[0]);
+    vsapi->freeFrame(src[2]);
+
+    if (!maskp || !counts) {
+        vsapi->freeFrame(src[1]);
+        vsapi->setFilterError("CombMatch: failed to allocate buffers.",
+                              frame_ctx);
+        return NULL;
+    }
+
+    VSFrameRef *dst = vsapi->copyFrame(src[1], core);
+    vsapi->freeFrame(src[1]);
+
+    VSMap *props = vsapi->getFramePropsRW(dst);
+    for (int i = 0; i < 3; i++) {
+        int append = i == 0 ? paReplace : paAppend;
+        vsapi->propSetInt(props, "CombMatchBlocks", blocks[i], append);
+        vsapi->propSetInt(props, "CombMatchMics", mics[i], append);
+    }
+
+    return dst;
+}
+
+
+static void VS_CC
+init_combmatch(VSMap *in, VSMap *out, void **instance_data, VSNode *node,
+               VSCore *core, const VSAPI *vsapi)
+{
+    combmatch_t *mh = (combmatch_t *)*instance_data;
+    vsapi->setVideoInfo(mh->vi, 1, node);
+    vsapi->clearMap(in);
+}
+
+
+static void VS_CC
+close_combmatch(void *instance_data, VSCore *core, const VSAPI *vsapi)
+{
+    combmatch_t *mh = (combmatch_t *)instance_data;
+    if (!mh) {
+        return;
+    }
+    if (mh->node) {
+        vsapi->freeNode(mh->node);
+    }
+    free(mh);
+}
+
+
+static int
+get_param(const VSMap *in, const char *name, int undef, const VSAPI *vsapi)
+{
+    int err;
+    int value = (int)vsapi->propGetInt(in, name, 0, &err);
+    return err ? undef : value;
+}
+
+
+void VS_CC
+create_combmatch(const VSMap *in, VSMap *out, void *user_data, VSCore *core,
+                 const VSAPI *vsapi)
+{
+#define RET_IF_ERROR(cond, ...) \
+{ \
+    if (cond) { \
+        close_combmatch(mh, core, vsapi); \
+        snprintf(msg, 240, __VA_ARGS__); \
+        vsapi->setError(out, msg_buff); \
+        return; \
+    } \
+}
+
+    char msg_buff[256] = "CombMatch: ";
+    char *msg = msg_buff + strlen(msg_buff);
+
+    combmatch_t *mh = (combmatch_t *)calloc(sizeof(combmatch_t), 1);
+    RET_IF_ERROR(!mh, "failed to allocate handler.");
+
+    mh->node = vsapi->propGetNode(in, "clip", 0, 0);
+    mh->vi = vsapi->getVideoInfo(mh->node);
+    RET_IF_ERROR(mh->vi->width == 0 || mh->vi->height == 0 || !mh->vi->format,
+                 "clip is not constant resolution/format.");
+    RET_IF_ERROR(mh->vi->format->sampleType != stInteger ||
+                 mh->vi->format->bitsPerSample != 8,
+                 "clip is not 8bit integer format.");
+
+    mh->plane = get_param(in, "plane", 0, vsapi);
+    RET_IF_ERROR(mh->plane < 0 || mh->plane >= mh->vi->format->numPlanes,
+                 "plane index out of range.");
+
+    mh->field = get_param(in, "field", 1, vsapi);
+    RET_IF_ERROR(mh->field < 0 || mh->field > 1, "field must be 0 or 1.");
+
+    mh->cthresh = get_param(in, "cthresh", 6, vsapi);
+    RET_IF_ERROR(mh->cthresh < 0 || mh->cthresh > 255,
+                 "cthresh must be between 0 and 255.");
+
+    mh->blockx = get_param(in, "blockx", 8, vsapi);
+    RET_IF_ERROR(mh->blockx < 4 || mh->blockx > 256,
+                 "blockx must be between 4 and 256.");
+
+    mh->blocky = get_param(in, "blocky", 16, vsapi);
+    RET_IF_ERROR(mh->blocky < 4 || mh->blocky > 256,
+                 "blocky must be between 4 and 256.");
+
+    int max_mi = mh->blockx * mh->blocky;
+    mh->mi = get_param(in, "mi", 40, vsapi);
+    RET_IF_ERROR(mh->mi < 0 || mh->mi > max_mi,
+                 "mi must be between 0 and %d.", max_mi);
+
+    vsapi->createFilter(in, out, "CombMatch", init_combmatch,
+                        get_frame_combmatch, close_combmatch, fmParallel, 0,
+                        mh, core);
+
+#undef RET_IF_ERROR
+}
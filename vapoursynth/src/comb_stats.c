@@ -0,0 +1,1072 @@
+/*
+  comb_stats.c: Copyright (C) 2012-2013  Oka Motofumi
+
+  Author: Oka Motofumi (chikuzen.mo at gmail dot com)
+
+  This file is part of CombMask.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with the author; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#ifdef _WIN32
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600
+#endif
+#include <windows.h>
+typedef CRITICAL_SECTION cal_lock_t;
+typedef CONDITION_VARIABLE cal_cond_t;
+#define cal_lock_init(l) InitializeCriticalSection(l)
+#define cal_lock_destroy(l) DeleteCriticalSection(l)
+#define cal_lock(l) EnterCriticalSection(l)
+#define cal_unlock(l) LeaveCriticalSection(l)
+#define cal_cond_init(c) InitializeConditionVariable(c)
+#define cal_cond_destroy(c)
+#define cal_wait(c, l) SleepConditionVariableCS(c, l, INFINITE)
+#define cal_signal(c) WakeConditionVariable(c)
+#else
+#include <pthread.h>
+typedef pthread_mutex_t cal_lock_t;
+typedef pthread_cond_t cal_cond_t;
+#define cal_lock_init(l) pthread_mutex_init(l, NULL)
+#define cal_lock_destroy(l) pthread_mutex_destroy(l)
+#define cal_lock(l) pthread_mutex_lock(l)
+#define cal_unlock(l) pthread_mutex_unlock(l)
+#define cal_cond_init(c) pthread_cond_init(c, NULL)
+#define cal_cond_destroy(c) pthread_cond_destroy(c)
+#define cal_wait(c, l) pthread_cond_wait(c, l)
+#define cal_signal(c) pthread_cond_signal(c)
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "VapourSynth.h"
+#include "combmask.h"
+
+#ifdef _MSC_VER
+#define snprintf _snprintf
+#endif
+
+#define MAX_THRESHOLDS 16
+
+/*
+ CombStats evaluates the metric of CombMask once per pixel and counts the
+ combed pixels and the combed blocks for every combination of the given
+ cthresh, mthresh and mi values.
+
+ The spatial score of a pixel is the largest cthresh for which it is still
+ combed, i.e. it is combed for cthresh when score > cthresh:
+   min(max(c - max(b, d), min(b, d) - c), ceil(|a + 4c + e - 3(b + d)| / 6))
+ and its motion is the largest |src - prev| of the lines above, the line
+ itself and below (the vertical dilation of the motion mask).
+ Each pixel is put into a bin of (number of cthresh below its score, number
+ of mthresh below its motion), so a pixel is combed for the i'th cthresh and
+ the j'th mthresh (in ascending order) when its bin is at least (i+1, j+1).
+*/
+typedef struct combstats {
+    VSNodeRef *node;
+    const VSVideoInfo *vi;
+    int plane;
+    int blockx;
+    int blocky;
+    int num_cth;
+    int num_mth;
+    int num_mi;
+    int cthresh[MAX_THRESHOLDS];
+    int mthresh[MAX_THRESHOLDS];
+    int mi[MAX_THRESHOLDS];
+    int rank_c[MAX_THRESHOLDS];  // ascending position of each cthresh
+    int rank_m[MAX_THRESHOLDS];
+    uint8_t *bin_c;              // score -> bin
+    uint8_t *bin_m;              // motion -> bin
+} combstats_t;
+
+
+static inline int
+get_pix(const uint8_t *row, int x, int bytes)
+{
+    return bytes == 1 ? row[x] : ((const uint16_t *)row)[x];
+}
+
+
+static inline int
+reflect(int y, int height)
+{
+    return y < 0 ? -y : y > height - 1 ? 2 * (height - 1) - y : y;
+}
+
+
+static inline int
+abs_diff(int x, int y)
+{
+    return x > y ? x - y : y - x;
+}
+
+
+/* the five lines around the line y, and the three of the previous frame. */
+typedef struct {
+    const uint8_t *a, *b, *c, *d, *e;
+    const uint8_t *pb, *pc, *pd;
+} lines_t;
+
+
+static inline void
+set_lines(lines_t *l, const uint8_t *srcp, const uint8_t *prevp, int stride,
+          int height, int y)
+{
+    int yb = reflect(y - 1, height) * stride;
+    int yd = reflect(y + 1, height) * stride;
+    l->a = srcp + reflect(y - 2, height) * stride;
+    l->b = srcp + yb;
+    l->c = srcp + y * stride;
+    l->d = srcp + yd;
+    l->e = srcp + reflect(y + 2, height) * stride;
+    l->pb = prevp ? prevp + yb : NULL;
+    l->pc = prevp ? prevp + y * stride : NULL;
+    l->pd = prevp ? prevp + yd : NULL;
+}
+
+
+static inline int
+get_score(const lines_t *l, int x, int bytes)
+{
+    int vb = get_pix(l->b, x, bytes), vc = get_pix(l->c, x, bytes);
+    int vd = get_pix(l->d, x, bytes);
+    int hi = vb > vd ? vb : vd, lo = vb < vd ? vb : vd;
+    int s1 = vc - hi > lo - vc ? vc - hi : lo - vc;
+    int sum = get_pix(l->a, x, bytes) + 4 * vc + get_pix(l->e, x, bytes)
+            - 3 * (vb + vd);
+    int s2 = ((sum < 0 ? -sum : sum) + 5) / 6;
+    int score = s1 < s2 ? s1 : s2;
+    return score < 0 ? 0 : score;
+}
+
+
+static inline int
+get_motion(const lines_t *l, int x, int bytes)
+{
+    if (!l->pc) {
+        return 0;
+    }
+    int m0 = abs_diff(get_pix(l->b, x, bytes), get_pix(l->pb, x, bytes));
+    int m1 = abs_diff(get_pix(l->c, x, bytes), get_pix(l->pc, x, bytes));
+    int m2 = abs_diff(get_pix(l->d, x, bytes), get_pix(l->pd, x, bytes));
+    int motion = m0 > m1 ? m0 : m1;
+    return motion > m2 ? motion : m2;
+}
+
+
+/* suffix sums of a (num_c + 1) x (num_m + 1) histogram, in place. */
+static void
+accumulate_bins(uint32_t *hist, int num_c, int num_m)
+{
+    int w = num_m + 1;
+    for (int i = num_c; i >= 0; i--) {
+        for (int j = num_m; j >= 0; j--) {
+            uint32_t v = hist[i * w + j];
+            if (i < num_c) {
+                v += hist[(i + 1) * w + j];
+            }
+            if (j < num_m) {
+                v += hist[i * w + j + 1];
+            }
+            if (i < num_c && j < num_m) {
+                v -= hist[(i + 1) * w + j + 1];
+            }
+            hist[i * w + j] = v;
+        }
+    }
+}
+
+
+static int
+collect_stats(combstats_t *sh, const VSAPI *vsapi, const VSFrameRef *src,
+              const VSFrameRef *prev, int64_t *pixels, int64_t *blocks)
+{
+    int p = sh->plane;
+    int bytes = sh->vi->format->bytesPerSample;
+    int width = vsapi->getFrameWidth(src, p);
+    int height = vsapi->getFrameHeight(src, p);
+    int stride = vsapi->getStride(src, p);
+    const uint8_t *srcp = vsapi->getReadPtr(src, p);
+    const uint8_t *prevp = prev ? vsapi->getReadPtr(prev, p) : NULL;
+
+    int nc = sh->num_cth, nm = sh->num_mth, nmi = sh->num_mi;
+    int bins = (nc + 1) * (nm + 1);
+    int num_blocks = width / sh->blockx;
+    int last_line = height / sh->blocky * sh->blocky;
+
+    // one histogram per block of the current line of blocks, and the whole.
+    uint32_t *hist = (uint32_t *)calloc(bins * (num_blocks + 1),
+                                        sizeof(uint32_t));
+    if (!hist) {
+        return -1;
+    }
+    uint32_t *total = hist + bins * num_blocks;
+
+    for (int y = 0; height >= 3 && y < height; y++) {
+        lines_t l;
+        set_lines(&l, srcp, prevp, stride, height, y);
+
+        for (int x = 0; x < width; x++) {
+            int score = get_score(&l, x, bytes);
+            int motion = get_motion(&l, x, bytes);
+
+            int bin = sh->bin_c[score] * (nm + 1) + sh->bin_m[motion];
+            total[bin]++;
+            if (y < last_line && x < num_blocks * sh->blockx) {
+                hist[(x / sh->blockx) * bins + bin]++;
+            }
+        }
+
+        if (y >= last_line || (y + 1) % sh->blocky > 0) {
+            continue;
+        }
+        for (int i = 0; i < num_blocks; i++) {
+            uint32_t *h = hist + i * bins;
+            accumulate_bins(h, nc, nm);
+            for (int u = 0; u < nc; u++) {
+                for (int v = 0; v < nm; v++) {
+                    uint32_t count = h[(sh->rank_c[u] + 1) * (nm + 1)
+                                       + sh->rank_m[v] + 1];
+                    for (int k = 0; k < nmi; k++) {
+                        blocks[(u * nm + v) * nmi + k] += count > (uint32_t)sh->mi[k];
+                    }
+                }
+            }
+        }
+        memset(hist, 0, bins * num_blocks * sizeof(uint32_t));
+    }
+
+    accumulate_bins(total, nc, nm);
+    for (int u = 0; u < nc; u++) {
+        for (int v = 0; v < nm; v++) {
+            pixels[u * nm + v] = total[(sh->rank_c[u] + 1) * (nm + 1)
+                                       + sh->rank_m[v] + 1];
+        }
+    }
+
+    free(hist);
+    return 0;
+}
+
+
+static const VSFrameRef * VS_CC
+get_frame_combstats(int n, int activation_reason, void **instance_data,
+                    void **frame_data, VSFrameContext *frame_ctx, VSCore *core,
+                    const VSAPI *vsapi)
+{
+    combstats_t *sh = (combstats_t *)*instance_data;
+    int use_motion = sh->vi->numFrames > 1;
+    int p = n == 0 ? 1 : n - 1;
+
+    if (activation_reason == arInitial) {
+        vsapi->requestFrameFilter(n, sh->node, frame_ctx);
+        if (use_motion) {
+            vsapi->requestFrameFilter(p, sh->node, frame_ctx);
+        }
+        return NULL;
+    }
+
+    if (activation_reason != arAllFramesReady) {
+        return NULL;
+    }
+
+    const VSFrameRef *src = vsapi->getFrameFilter(n, sh->node, frame_ctx);
+    const VSFrameRef *prev = use_motion
+        ? vsapi->getFrameFilter(p, sh->node, frame_ctx) : NULL;
+
+    int64_t pixels[MAX_THRESHOLDS * MAX_THRESHOLDS] = {0};
+    int64_t blocks[MAX_THRESHOLDS * MAX_THRESHOLDS * MAX_THRESHOLDS] = {0};
+    int ret = collect_stats(sh, vsapi, src, prev, pixels, blocks);
+    vsapi->freeFrame(prev);
+    if (ret < 0) {
+        vsapi->freeFrame(src);
+        vsapi->setFilterError("CombStats: failed to allocate histogram.",
+                              frame_ctx);
+        return NULL;
+    }
+
+    VSFrameRef *dst = vsapi->copyFrame(src, core);
+    vsapi->freeFrame(src);
+
+    VSMap *props = vsapi->getFramePropsRW(dst);
+    int num = sh->num_cth * sh->num_mth;
+    for (int i = 0; i < num; i++) {
+        vsapi->propSetInt(props, "CombPixels", pixels[i],
+                          i == 0 ? paReplace : paAppend);
+    }
+    for (int i = 0; i < num * sh->num_mi; i++) {
+        vsapi->propSetInt(props, "CombBlocks", blocks[i],
+                          i == 0 ? paReplace : paAppend);
+    }
+
+    return dst;
+}
+
+
+static void VS_CC
+init_combstats(VSMap *in, VSMap *out, void **instance_data, VSNode *node,
+               VSCore *core, const VSAPI *vsapi)
+{
+    combstats_t *sh = (combstats_t *)*instance_data;
+    vsapi->setVideoInfo(sh->vi, 1, node);
+    vsapi->clearMap(in);
+}
+
+
+static void VS_CC
+close_combstats(void *instance_data, VSCore *core, const VSAPI *vsapi)
+{
+    combstats_t *sh = (combstats_t *)instance_data;
+    if (!sh) {
+        return;
+    }
+    if (sh->node) {
+        vsapi->freeNode(sh->node);
+    }
+    free(sh->bin_c);
+    free(sh);
+}
+
+
+/*
+ reads an int array into dst. returns the number of values, 0 if undefined,
+ or -1 if any value is out of range or there are too many of them.
+*/
+static int
+get_thresholds(int *dst, const char *name, int min, int max, const VSMap *in,
+               const VSAPI *vsapi)
+{
+    int num = vsapi->propNumElements(in, name);
+    if (num < 1) {
+        return 0;
+    }
+    if (num > MAX_THRESHOLDS) {
+        return -1;
+    }
+    for (int i = 0; i < num; i++) {
+        dst[i] = (int)vsapi->propGetInt(in, name, i, NULL);
+        if (dst[i] < min || dst[i] > max) {
+            return -1;
+        }
+    }
+    return num;
+}
+
+
+/* ascending position of each value, and the bins of 0 to max. */
+static void
+set_bins(const int *values, int num, int max, int *rank, uint8_t *bin)
+{
+    int sorted[MAX_THRESHOLDS];
+    memcpy(sorted, values, num * sizeof(int));
+    for (int i = 1; i < num; i++) {
+        for (int j = i; j > 0 && sorted[j - 1] > sorted[j]; j--) {
+            int t = sorted[j];
+            sorted[j] = sorted[j - 1];
+            sorted[j - 1] = t;
+        }
+    }
+    for (int i = 0; i < num; i++) {
+        rank[i] = 0;
+        while (sorted[rank[i]] != values[i]) {
+            rank[i]++;
+        }
+    }
+    for (int v = 0, i = 0; v <= max; v++) {
+        while (i < num && v > sorted[i]) {
+            i++;
+        }
+        bin[v] = (uint8_t)i;
+    }
+}
+
+
+void VS_CC
+create_combstats(const VSMap *in, VSMap *out, void *user_data, VSCore *core,
+                 const VSAPI *vsapi)
+{
+#define RET_IF_ERROR(cond, ...) \
+{ \
+    if (cond) { \
+        close_combstats(sh, core, vsapi); \
+        snprintf(msg, 240, __VA_ARGS__); \
+        vsapi->setError(out, msg_buff); \
+        return; \
+    } \
+}
+
+    char msg_buff[256] = "CombStats: ";
+    char *msg = msg_buff + strlen(msg_buff);
+
+    combstats_t *sh = (combstats_t *)calloc(sizeof(combstats_t), 1);
+    RET_IF_ERROR(!sh, "failed to allocate handler.");
+
+    sh->node = vsapi->propGetNode(in, "clip", 0, 0);
+    sh->vi = vsapi->getVideoInfo(sh->node);
+    RET_IF_ERROR(sh->vi->width == 0 || sh->vi->height == 0 || !sh->vi->format,
+                 "clip is not constant resolution/format.");
+    RET_IF_ERROR(sh->vi->format->sampleType != stInteger,
+                 "clip is not integer format.");
+
+    int mag = 1 << (sh->vi->format->bitsPerSample - 8);
+    int max = (1 << sh->vi->format->bitsPerSample) - 1;
+    int err;
+
+    sh->plane = (int)vsapi->propGetInt(in, "plane", 0, &err);
+    RET_IF_ERROR(sh->plane < 0 || sh->plane >= sh->vi->format->numPlanes,
+                 "plane index out of range.");
+
+    sh->blockx = (int)vsapi->propGetInt(in, "blockx", 0, &err);
+    if (err) {
+        sh->blockx = 8;
+    }
+    sh->blocky = (int)vsapi->propGetInt(in, "blocky", 0, &err);
+    if (err) {
+        sh->blocky = 16;
+    }
+    RET_IF_ERROR(sh->blockx < 4 || sh->blockx > 256,
+                 "blockx must be between 4 and 256.");
+    RET_IF_ERROR(sh->blocky < 4 || sh->blocky > 256,
+                 "blocky must be between 4 and 256.");
+
+    sh->num_cth = get_thresholds(sh->cthresh, "cthresh", 0, max, in, vsapi);
+    RET_IF_ERROR(sh->num_cth < 0, "cthresh must be up to %d values between "
+                 "0 and %d.", MAX_THRESHOLDS, max);
+    if (sh->num_cth == 0) {
+        sh->cthresh[sh->num_cth++] = 6 * mag;
+    }
+
+    sh->num_mth = get_thresholds(sh->mthresh, "mthresh", 0, max, in, vsapi);
+    RET_IF_ERROR(sh->num_mth < 0, "mthresh must be up to %d values between "
+                 "0 and %d.", MAX_THRESHOLDS, max);
+    if (sh->num_mth == 0) {
+        sh->mthresh[sh->num_mth++] = 9 * mag;
+    }
+
+    int max_mi = sh->blockx * sh->blocky;
+    sh->num_mi = get_thresholds(sh->mi, "mi", 0, max_mi, in, vsapi);
+    RET_IF_ERROR(sh->num_mi < 0, "mi must be up to %d values between 0 and "
+                 "%d.", MAX_THRESHOLDS, max_mi);
+    if (sh->num_mi == 0) {
+        sh->mi[sh->num_mi++] = 40;
+    }
+
+    sh->bin_c = (uint8_t *)malloc((max + 1) * 2);
+    RET_IF_ERROR(!sh->bin_c, "failed to allocate tables.");
+    sh->bin_m = sh->bin_c + max + 1;
+
+    // mthresh=0 disables the motion check as CombMask does, and so does a
+    // clip of single frame.
+    int mth[MAX_THRESHOLDS];
+    for (int i = 0; i < sh->num_mth; i++) {
+        mth[i] = sh->vi->numFrames > 1 && sh->mthresh[i] > 0 ?
+            sh->mthresh[i] : -1;
+    }
+    set_bins(sh->cthresh, sh->num_cth, max, sh->rank_c, sh->bin_c);
+    set_bins(mth, sh->num_mth, max, sh->rank_m, sh->bin_m);
+
+    vsapi->createFilter(in, out, "CombStats", init_combstats,
+                        get_frame_combstats, close_combstats, fmParallel, 0,
+                        sh, core);
+
+#undef RET_IF_ERROR
+}
+
+
+/*
+ Calibrate samples frames of the clip, and proposes cthresh, mthresh and mi
+ for CombMask/IsCombed.
+
+ The sampled frames are requested asynchronously, so they are decoded and
+ measured on the threads of the core. The first pass builds a histogram of
+ (motion, score) in 8-bit scale, and the second pass counts the combed
+ pixels of each block with the proposed cthresh and mthresh.
+   mthresh: twice the median motion plus 4, i.e. above the temporal noise.
+   cthresh: the 99th percentile of the scores of the static pixels, which
+            can not be combed and show how much the texture/noise scores.
+   mi:      Otsu's threshold of the counts of the blocks which have any
+            combed pixels, i.e. the gap between noise and combing.
+ When cache is given, the proposal is stored in that file with a key made of
+ the clip properties, the parameters and a hash of the first, middle and
+ last frames, and later calls with the same key skip the passes.
+*/
+#define CAL_BINS 256
+
+struct calibrate;
+
+typedef struct {
+    struct calibrate *cal;
+    int slot;
+} cal_request_t;
+
+typedef struct calibrate {
+    VSNodeRef *node;
+    const VSVideoInfo *vi;
+    const VSAPI *vsapi;
+    int plane;
+    int blockx;
+    int blocky;
+    int shift;          // to 8-bit scale
+    int use_motion;
+    int num_samples;
+    int threads;
+    int *frames;
+    cal_request_t *requests;
+    const VSFrameRef **slots;   // src and prev of each sample
+    uint8_t *arrived;
+    int phase;
+    int cthresh;
+    int mthresh;
+    int next;
+    int pending;
+    uint64_t *joint;    // CAL_BINS motions x CAL_BINS scores
+    uint64_t *counts;   // blockx * blocky + 1
+    char error[256];
+    cal_lock_t lock;
+    cal_cond_t cond;
+} calibrate_t;
+
+
+static void
+calib_histogram(calibrate_t *cal, const VSFrameRef *src,
+                const VSFrameRef *prev, uint32_t *joint)
+{
+    const VSAPI *vsapi = cal->vsapi;
+    int p = cal->plane;
+    int bytes = cal->vi->format->bytesPerSample;
+    int width = vsapi->getFrameWidth(src, p);
+    int height = vsapi->getFrameHeight(src, p);
+    int stride = vsapi->getStride(src, p);
+    const uint8_t *srcp = vsapi->getReadPtr(src, p);
+    const uint8_t *prevp = prev ? vsapi->getReadPtr(prev, p) : NULL;
+
+    for (int y = 0; height >= 3 && y < height; y++) {
+        lines_t l;
+        set_lines(&l, srcp, prevp, stride, height, y);
+        for (int x = 0; x < width; x++) {
+            int score = get_score(&l, x, bytes) >> cal->shift;
+            int motion = get_motion(&l, x, bytes) >> cal->shift;
+            joint[motion * CAL_BINS + score]++;
+        }
+    }
+}
+
+
+/* returns 0 if it fails to allocate the counts of a line of blocks. */
+static int
+calib_blocks(calibrate_t *cal, const VSFrameRef *src, const VSFrameRef *prev,
+             uint32_t *counts)
+{
+    const VSAPI *vsapi = cal->vsapi;
+    int p = cal->plane;
+    int bytes = cal->vi->format->bytesPerSample;
+    int width = vsapi->getFrameWidth(src, p);
+    int height = vsapi->getFrameHeight(src, p);
+    int stride = vsapi->getStride(src, p);
+    const uint8_t *srcp = vsapi->getReadPtr(src, p);
+    const uint8_t *prevp = prev && cal->mthresh > 0
+        ? vsapi->getReadPtr(prev, p) : NULL;
+    int num_blocks = width / cal->blockx;
+    int last_line = height / cal->blocky * cal->blocky;
+
+    uint32_t *block = (uint32_t *)calloc(num_blocks + 1, sizeof(uint32_t));
+    if (!block) {
+        return 0;
+    }
+
+    for (int y = 0; height >= 3 && y < last_line; y++) {
+        lines_t l;
+        set_lines(&l, srcp, prevp, stride, height, y);
+        for (int x = 0; x < num_blocks * cal->blockx; x++) {
+            if (get_score(&l, x, bytes) > cal->cthresh &&
+                (!prevp || get_motion(&l, x, bytes) > cal->mthresh)) {
+                block[x / cal->blockx]++;
+            }
+        }
+        if ((y + 1) % cal->blocky > 0) {
+            continue;
+        }
+        for (int i = 0; i < num_blocks; i++) {
+            counts[block[i]]++;
+        }
+        memset(block, 0, num_blocks * sizeof(uint32_t));
+    }
+
+    free(block);
+    return 1;
+}
+
+
+static void VS_CC
+calib_frame_done(void *user_data, const VSFrameRef *f, int n, VSNodeRef *node,
+                 const char *error_msg);
+
+
+static void
+request_sample(calibrate_t *cal, int i)
+{
+    int n = cal->frames[i];
+    cal->vsapi->getFrameAsync(n, cal->node, calib_frame_done,
+                              cal->requests + i * 2);
+    if (cal->use_motion) {
+        cal->vsapi->getFrameAsync(n == 0 ? 1 : n - 1, cal->node,
+                                  calib_frame_done, cal->requests + i * 2 + 1);
+    }
+}
+
+
+static void
+process_sample(calibrate_t *cal, const VSFrameRef *src,
+               const VSFrameRef *prev)
+{
+    int area = cal->blockx * cal->blocky;
+    int num = cal->phase == 0 ? CAL_BINS * CAL_BINS : area + 1;
+    uint32_t *local = (uint32_t *)calloc(num, sizeof(uint32_t));
+    int blocks_ok = 1;
+
+    if (local) {
+        if (cal->phase == 0) {
+            calib_histogram(cal, src, prev, local);
+        } else {
+            blocks_ok = calib_blocks(cal, src, prev, local);
+        }
+    }
+
+    cal_lock(&cal->lock);
+    if (!local) {
+        snprintf(cal->error, sizeof(cal->error), "failed to allocate histogram.");
+    } else if (!blocks_ok) {
+        snprintf(cal->error, sizeof(cal->error),
+                 "failed to allocate block counts.");
+    } else {
+        uint64_t *dst = cal->phase == 0 ? cal->joint : cal->counts;
+        for (int i = 0; i < num; i++) {
+            dst[i] += local[i];
+        }
+    }
+    cal_unlock(&cal->lock);
+
+    free(local);
+}
+
+
+static void VS_CC
+calib_frame_done(void *user_data, const VSFrameRef *f, int n, VSNodeRef *node,
+                 const char *error_msg)
+{
+    cal_request_t *req = (cal_request_t *)user_data;
+    calibrate_t *cal = req->cal;
+    int i = req->slot / 2;
+    const VSFrameRef *src = NULL, *prev = NULL;
+    int ready = 0, failed;
+
+    cal_lock(&cal->lock);
+    if (!f && !cal->error[0]) {
+        snprintf(cal->error, sizeof(cal->error), "failed to get frame %d: %s",
+                 n, error_msg ? error_msg : "unknown error");
+    }
+    cal->slots[req->slot] = f;
+    cal->arrived[req->slot] = 1;
+    if (cal->arrived[i * 2] && cal->arrived[i * 2 + 1]) {
+        src = cal->slots[i * 2];
+        prev = cal->slots[i * 2 + 1];
+        ready = 1;
+    }
+    failed = cal->error[0] != 0;
+    cal_unlock(&cal->lock);
+
+    if (!ready) {
+        return;
+    }
+
+    if (!failed) {
+        process_sample(cal, src, prev);
+    }
+    if (src) {
+        cal->vsapi->freeFrame(src);
+    }
+    if (prev) {
+        cal->vsapi->freeFrame(prev);
+    }
+
+    cal_lock(&cal->lock);
+    int next = cal->next < cal->num_samples ? cal->next++ : -1;
+    cal_unlock(&cal->lock);
+
+    if (next >= 0) {
+        request_sample(cal, next);
+    }
+
+    cal_lock(&cal->lock);
+    if (--cal->pending == 0) {
+        cal_signal(&cal->cond);
+    }
+    cal_unlock(&cal->lock);
+}
+
+
+static int
+run_phase(calibrate_t *cal, int phase)
+{
+    int first = cal->num_samples < cal->threads ? cal->num_samples
+                                                : cal->threads;
+
+    cal->phase = phase;
+    cal->pending = cal->num_samples;
+    cal->next = first;
+    for (int i = 0; i < cal->num_samples * 2; i++) {
+        cal->slots[i] = NULL;
+        cal->arrived[i] = !cal->use_motion && (i & 1);
+    }
+
+    for (int i = 0; i < first; i++) {
+        request_sample(cal, i);
+    }
+
+    cal_lock(&cal->lock);
+    while (cal->pending > 0) {
+        cal_wait(&cal->cond, &cal->lock);
+    }
+    cal_unlock(&cal->lock);
+
+    return cal->error[0] ? -1 : 0;
+}
+
+
+/* the smallest value whose cumulative count reaches num/den of the total. */
+static int
+percentile(const uint64_t *hist, int size, int num, int den)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < size; i++) {
+        total += hist[i];
+    }
+    uint64_t target = (total * num + den - 1) / den;
+    uint64_t sum = 0;
+    for (int i = 0; i < size; i++) {
+        sum += hist[i];
+        if (sum >= target) {
+            return i;
+        }
+    }
+    return size - 1;
+}
+
+
+/* Otsu's threshold of hist[1] to hist[size - 1]. returns -1 if empty. */
+static int
+otsu_threshold(const uint64_t *hist, int size)
+{
+    double total = 0.0, sum = 0.0;
+    for (int i = 1; i < size; i++) {
+        total += (double)hist[i];
+        sum += (double)hist[i] * i;
+    }
+    if (total == 0.0) {
+        return -1;
+    }
+
+    double weight = 0.0, sum_b = 0.0, best = -1.0;
+    int threshold = 1;
+    for (int i = 1; i < size - 1; i++) {
+        weight += (double)hist[i];
+        sum_b += (double)hist[i] * i;
+        if (weight == 0.0 || weight == total) {
+            continue;
+        }
+        double mb = sum_b / weight;
+        double mf = (sum - sum_b) / (total - weight);
+        double var = weight * (total - weight) * (mb - mf) * (mb - mf);
+        if (var > best) {
+            best = var;
+            threshold = i;
+        }
+    }
+    return threshold;
+}
+
+
+static void
+propose_thresholds(calibrate_t *cal)
+{
+    uint64_t motion[CAL_BINS] = {0};
+    for (int m = 0; m < CAL_BINS; m++) {
+        for (int s = 0; s < CAL_BINS; s++) {
+            motion[m] += cal->joint[m * CAL_BINS + s];
+        }
+    }
+
+    int mth = 0;
+    if (cal->use_motion) {
+        mth = percentile(motion, CAL_BINS, 1, 2) * 2 + 4;
+        mth = mth > CAL_BINS - 1 ? CAL_BINS - 1 : mth;
+    }
+
+    uint64_t score[CAL_BINS] = {0};
+    for (int m = 0; m <= mth; m++) {
+        for (int s = 0; s < CAL_BINS; s++) {
+            score[s] += cal->joint[m * CAL_BINS + s];
+        }
+    }
+    int cth = percentile(score, CAL_BINS, 99, 100);
+    cth = cth < 4 ? 4 : cth > 32 ? 32 : cth;
+
+    cal->cthresh = cth << cal->shift;
+    cal->mthresh = mth << cal->shift;
+}
+
+
+static int
+propose_mi(calibrate_t *cal)
+{
+    int area = cal->blockx * cal->blocky;
+    int mi = otsu_threshold(cal->counts, area + 1);
+    if (mi < 0) {
+        return area * 40 / 128;
+    }
+    return mi < area / 8 ? area / 8 : mi > area / 2 ? area / 2 : mi;
+}
+
+
+static uint64_t
+hash_frame(uint64_t hash, const VSFrameRef *f, int p, int bytes,
+           const VSAPI *vsapi)
+{
+    int rowsize = vsapi->getFrameWidth(f, p) * bytes;
+    int height = vsapi->getFrameHeight(f, p);
+    int stride = vsapi->getStride(f, p);
+    const uint8_t *srcp = vsapi->getReadPtr(f, p);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < rowsize; x++) {
+            hash = (hash ^ srcp[x]) * 0x100000001b3ULL; // FNV-1a
+        }
+        srcp += stride;
+    }
+    return hash;
+}
+
+
+static int
+make_cache_key(calibrate_t *cal, char *key, int size, char *err, int err_size)
+{
+    const VSVideoInfo *vi = cal->vi;
+    int n[3] = {0, vi->numFrames / 2, vi->numFrames - 1};
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (int i = 0; i < 3; i++) {
+        const VSFrameRef *f = cal->vsapi->getFrame(n[i], cal->node, err,
+                                                   err_size);
+        if (!f) {
+            return -1;
+        }
+        hash = hash_frame(hash, f, cal->plane, vi->format->bytesPerSample,
+                          cal->vsapi);
+        cal->vsapi->freeFrame(f);
+    }
+
+    snprintf(key, size, "%dx%d:%d:%d:%lld/%lld:%d:%dx%d:%d:%016llx",
+             vi->width, vi->height, vi->format->id, vi->numFrames,
+             (long long)vi->fpsNum, (long long)vi->fpsDen, cal->plane,
+             cal->blockx, cal->blocky, cal->num_samples,
+             (unsigned long long)hash);
+    return 0;
+}
+
+
+static int
+read_cache(const char *path, const char *key, int *values)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        return -1;
+    }
+
+    char line[512];
+    size_t len = strlen(key);
+    int ret = -1;
+    while (fgets(line, sizeof(line), fp)) {
+        if (strncmp(line, key, len) == 0 && line[len] == ' ' &&
+            sscanf(line + len, "%d %d %d", values, values + 1,
+                   values + 2) == 3) {
+            ret = 0;
+        }
+    }
+
+    fclose(fp);
+    return ret;
+}
+
+
+static void
+write_cache(const char *path, const char *key, const int *values)
+{
+    FILE *fp = fopen(path, "a");
+    if (!fp) {
+        return;
+    }
+    fprintf(fp, "%s %d %d %d\n", key, values[0], values[1], values[2]);
+    fclose(fp);
+}
+
+
+static void
+close_calibrate(calibrate_t *cal, const VSAPI *vsapi)
+{
+    if (!cal) {
+        return;
+    }
+    if (cal->node) {
+        vsapi->freeNode(cal->node);
+    }
+    free(cal->frames);
+    free(cal->requests);
+    free(cal->slots);
+    free(cal->arrived);
+    free(cal->joint);
+    free(cal->counts);
+    free(cal);
+}
+
+
+void VS_CC
+create_calibrate(const VSMap *in, VSMap *out, void *user_data, VSCore *core,
+                 const VSAPI *vsapi)
+{
+#define RET_IF_ERROR(cond, ...) \
+{ \
+    if (cond) { \
+        close_calibrate(cal, vsapi); \
+        snprintf(msg, 240, __VA_ARGS__); \
+        vsapi->setError(out, msg_buff); \
+        return; \
+    } \
+}
+
+    char msg_buff[256] = "Calibrate: ";
+    char *msg = msg_buff + strlen(msg_buff);
+
+    calibrate_t *cal = (calibrate_t *)calloc(sizeof(calibrate_t), 1);
+    RET_IF_ERROR(!cal, "failed to allocate handler.");
+    cal->vsapi = vsapi;
+
+    cal->node = vsapi->propGetNode(in, "clip", 0, 0);
+    cal->vi = vsapi->getVideoInfo(cal->node);
+    RET_IF_ERROR(cal->vi->width == 0 || cal->vi->height == 0 ||
+                 !cal->vi->format || cal->vi->numFrames == 0,
+                 "clip is not constant resolution/format/length.");
+    RET_IF_ERROR(cal->vi->format->sampleType != stInteger,
+                 "clip is not integer format.");
+
+    int err;
+    cal->plane = (int)vsapi->propGetInt(in, "plane", 0, &err);
+    RET_IF_ERROR(cal->plane < 0 || cal->plane >= cal->vi->format->numPlanes,
+                 "plane index out of range.");
+
+    cal->blockx = (int)vsapi->propGetInt(in, "blockx", 0, &err);
+    if (err) {
+        cal->blockx = 8;
+    }
+    cal->blocky = (int)vsapi->propGetInt(in, "blocky", 0, &err);
+    if (err) {
+        cal->blocky = 16;
+    }
+    RET_IF_ERROR(cal->blockx < 4 || cal->blockx > 256,
+                 "blockx must be between 4 and 256.");
+    RET_IF_ERROR(cal->blocky < 4 || cal->blocky > 256,
+                 "blocky must be between 4 and 256.");
+
+    cal->num_samples = (int)vsapi->propGetInt(in, "samples", 0, &err);
+    if (err) {
+        cal->num_samples = 24;
+    }
+    RET_IF_ERROR(cal->num_samples < 1, "samples must be 1 or higher.");
+    if (cal->num_samples > cal->vi->numFrames) {
+        cal->num_samples = cal->vi->numFrames;
+    }
+
+    cal->shift = cal->vi->format->bitsPerSample - 8;
+    cal->use_motion = cal->vi->numFrames > 1;
+    cal->threads = vsapi->getCoreInfo(core)->numThreads;
+    if (cal->threads < 1) {
+        cal->threads = 1;
+    }
+
+    const char *cache = vsapi->propGetData(in, "cache", 0, &err);
+    char key[256], key_err[200];
+    int values[3];
+    if (cache) {
+        RET_IF_ERROR(make_cache_key(cal, key, sizeof(key), key_err,
+                                    sizeof(key_err)), "%s", key_err);
+        if (read_cache(cache, key, values) == 0) {
+            vsapi->propSetInt(out, "cthresh", values[0], paReplace);
+            vsapi->propSetInt(out, "mthresh", values[1], paReplace);
+            vsapi->propSetInt(out, "mi", values[2], paReplace);
+            close_calibrate(cal, vsapi);
+            return;
+        }
+    }
+
+    int ns = cal->num_samples;
+    cal->frames = (int *)malloc(ns * sizeof(int));
+    cal->requests = (cal_request_t *)malloc(ns * 2 * sizeof(cal_request_t));
+    cal->slots = (const VSFrameRef **)malloc(ns * 2 * sizeof(VSFrameRef *));
+    cal->arrived = (uint8_t *)malloc(ns * 2);
+    cal->joint = (uint64_t *)calloc(CAL_BINS * CAL_BINS, sizeof(uint64_t));
+    cal->counts = (uint64_t *)calloc(cal->blockx * cal->blocky + 1,
+                                     sizeof(uint64_t));
+    RET_IF_ERROR(!cal->frames || !cal->requests || !cal->slots ||
+                 !cal->arrived || !cal->joint || !cal->counts,
+                 "failed to allocate buffers.");
+
+    // the center of each of num_samples equal sections.
+    for (int i = 0; i < ns; i++) {
+        cal->frames[i] = (int)((int64_t)(i * 2 + 1) * cal->vi->numFrames
+                               / (ns * 2));
+        cal->requests[i * 2].cal = cal->requests[i * 2 + 1].cal = cal;
+        cal->requests[i * 2].slot = i * 2;
+        cal->requests[i * 2 + 1].slot = i * 2 + 1;
+    }
+
+    cal_lock_init(&cal->lock);
+    cal_cond_init(&cal->cond);
+
+    int ret = run_phase(cal, 0);
+    if (ret == 0) {
+        propose_thresholds(cal);
+        ret = run_phase(cal, 1);
+    }
+
+    cal_cond_destroy(&cal->cond);
+    cal_lock_destroy(&cal->lock);
+    RET_IF_ERROR(ret < 0, "%.200s", cal->error);
+
+    values[0] = cal->cthresh;
+    values[1] = cal->mthresh;
+    values[2] = propose_mi(cal);
+    if (cache) {
+        write_cache(cache, key, values);
+    }
+
+    vsapi->propSetInt(out, "cthresh", values[0], paReplace);
+    vsapi->propSetInt(out, "mthresh", values[1], paReplace);
+    vsapi->propSetInt(out, "mi", values[2], paReplace);
+    close_calibrate(cal, vsapi);
+
+#undef RET_IF_ERROR
+}
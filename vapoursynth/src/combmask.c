@@ -71,6 +71,112 @@ set_param_int(int *param, const char *name, int undef, int min, int max,
 
 
 
+static uint8_t *
+alloc_block_map(block_map_t *bmap, const VSFrameRef *src, const VSAPI *vsapi)
+{
+    int num_planes = vsapi->getFrameFormat(src)->numPlanes;
+    size_t size = 0;
+    for (int p = 0; p < num_planes; p++) {
+        bmap->stride[p] = (vsapi->getFrameWidth(src, p) + 15) / 16;
+        size += bmap->stride[p] * ((vsapi->getFrameHeight(src, p) + 15) / 16);
+    }
+
+    uint8_t *buff = (uint8_t *)calloc(size, 1);
+    if (!buff) {
+        return NULL;
+    }
+
+    uint8_t *mapp = buff;
+    for (int p = 0; p < num_planes; p++) {
+        bmap->map[p] = mapp;
+        mapp += bmap->stride[p] * ((vsapi->getFrameHeight(src, p) + 15) / 16);
+    }
+
+    return buff;
+}
+
+
+/* returns nonzero if the props of src tell that the frame is not combed. */
+static int
+is_trusted_clean(int trust, const VSFrameRef *src, const VSAPI *vsapi)
+{
+    const VSMap *props = vsapi->getFramePropsRO(src);
+    int err;
+
+    if (trust & TRUST_COMBED) {
+        int64_t combed = vsapi->propGetInt(props, "_Combed", 0, &err);
+        if (!err && combed == 0) {
+            return 1;
+        }
+    }
+    if (trust & TRUST_FIELD_BASED) {
+        int64_t field_based = vsapi->propGetInt(props, "_FieldBased", 0, &err);
+        if (!err && field_based == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/* an empty mask with _Combed=0, shared by the frames skipping detection. */
+static const VSFrameRef *
+create_blank_mask(const VSVideoInfo *vi, VSCore *core, const VSAPI *vsapi)
+{
+    VSFrameRef *blank = vsapi->newVideoFrame(vi->format, vi->width, vi->height,
+                                             NULL, core);
+    for (int i = 0; i < vi->format->numPlanes; i++) {
+        memset(vsapi->getWritePtr(blank, i), 0,
+               vsapi->getStride(blank, i) * vsapi->getFrameHeight(blank, i));
+    }
+    vsapi->propSetInt(vsapi->getFramePropsRW(blank), "_Combed", 0, paReplace);
+    return blank;
+}
+
+
+/* converts the mask made in the source format to ch->out_vi.format. */
+static VSFrameRef *
+output_mask(combmask_t *ch, VSFrameRef *cmask, VSCore *core,
+            const VSAPI *vsapi)
+{
+    const VSFormat *fo = ch->out_vi.format;
+    if (fo == ch->vi->format) {
+        return cmask;
+    }
+
+    VSFrameRef *dst;
+    if (fo->bytesPerSample == ch->vi->format->bytesPerSample) {
+        // the luma plane is shared without copying.
+        const VSFrameRef *plane_src[] = {cmask};
+        int planes[] = {0};
+        dst = vsapi->newVideoFrame2(fo, ch->vi->width, ch->vi->height,
+                                    plane_src, planes, cmask, core);
+    } else {
+        dst = vsapi->newVideoFrame(fo, ch->vi->width, ch->vi->height, cmask,
+                                   core);
+        for (int p = 0; p < fo->numPlanes; p++) {
+            narrow_mask(cmask, dst, p, vsapi);
+        }
+    }
+    vsapi->freeFrame(cmask);
+    return dst;
+}
+
+
+static void
+set_motion_props(combmask_t *ch, const VSAPI *vsapi, VSFrameRef *cmask, int n,
+                 const motion_stats_t *stats)
+{
+    VSMap *props = vsapi->getFramePropsRW(cmask);
+    vsapi->propSetInt(props, "_SceneChangePrev",
+                      n > 0 && stats->sad > stats->pixels * ch->scthresh,
+                      paReplace);
+    vsapi->propSetFloat(props, "_MotionRatio", stats->pixels == 0 ? 0.0 :
+                        (double)stats->moving / stats->pixels, paReplace);
+}
+
+
 static const VSFrameRef * VS_CC
 get_frame_combmask(int n, int activation_reason, void **instance_data,
                    void **frame_data, VSFrameContext *frame_ctx, VSCore *core,
@@ -93,23 +199,117 @@ get_frame_combmask(int n, int activation_reason, void **instance_data,
 
     const VSFrameRef *src = vsapi->getFrameFilter(n, ch->node, frame_ctx);
 
+    if (ch->trust && is_trusted_clean(ch->trust, src, vsapi)) {
+        vsapi->freeFrame(src);
+        if (ch->history) {
+            ch->history[n] = 0;
+        }
+        return vsapi->cloneFrameRef(ch->blank);
+    }
+
+    if (ch->is_flat(ch, vsapi, src)) {
+        if (ch->history) {
+            ch->history[n] = 0;
+        }
+        if (ch->mthresh == 0) {
+            vsapi->freeFrame(src);
+            return vsapi->cloneFrameRef(ch->blank);
+        }
+        // a cut or fade to black is a scene change, so the motion props are
+        // still computed.
+        roi_t roi;
+        get_roi(ch, vsapi, src, &roi);
+        const VSFrameRef *prev = vsapi->getFrameFilter(p, ch->node, frame_ctx);
+        motion_stats_t stats = {0};
+        int ok = motion_stats(ch, vsapi, src, prev, &roi, &stats);
+        vsapi->freeFrame(prev);
+        vsapi->freeFrame(src);
+        if (!ok) {
+            vsapi->setFilterError("CombMask: failed to allocate motion buffer.",
+                                  frame_ctx);
+            return NULL;
+        }
+        VSFrameRef *blank = vsapi->copyFrame(ch->blank, core);
+        set_motion_props(ch, vsapi, blank, n, &stats);
+        return blank;
+    }
+
+    // a predicted clean frame is only verified on sampled lines, and gets an
+    // empty mask.
+    if (ch->history && predict_cadence(ch, n) == 0) {
+        const VSFrameRef *prev = ch->mthresh > 0
+            ? vsapi->getFrameFilter(p, ch->node, frame_ctx) : NULL;
+        int clean = verify_clean(ch, vsapi, src, prev);
+        vsapi->freeFrame(prev);
+        if (clean) {
+            vsapi->freeFrame(src);
+            ch->history[n] = 0;
+            return vsapi->cloneFrameRef(ch->blank);
+        }
+    }
+
     VSFrameRef *cmask = vsapi->newVideoFrame(ch->vi->format, ch->vi->width,
                                              ch->vi->height, NULL, core);
 
-    ch->write_combmask(ch, vsapi, src, cmask);
+    roi_t roi;
+    get_roi(ch, vsapi, src, &roi);
+
+    if (ch->mthresh == 0) {
+        ch->write_combmask(ch, vsapi, src, cmask, NULL, &roi);
+    } else {
+        block_map_t bmap;
+        uint8_t *buff = alloc_block_map(&bmap, src, vsapi);
+        if (!buff) {
+            vsapi->freeFrame(src);
+            vsapi->freeFrame(cmask);
+            vsapi->setFilterError("CombMask: failed to allocate block map.",
+                                  frame_ctx);
+            return NULL;
+        }
 
-    if (ch->mthresh > 0) {
         const VSFrameRef *prev = vsapi->getFrameFilter(p, ch->node, frame_ctx);
-        adapt_motion(ch, vsapi, src, prev, cmask);
+        motion_stats_t stats = {0};
+        int ok = adapt_motion(ch, vsapi, src, prev, cmask, &bmap, &roi,
+                              &stats);
         vsapi->freeFrame(prev);
+        if (!ok) {
+            free(buff);
+            vsapi->freeFrame(src);
+            vsapi->freeFrame(cmask);
+            vsapi->setFilterError("CombMask: failed to allocate motion buffer.",
+                                  frame_ctx);
+            return NULL;
+        }
+
+        ch->write_combmask(ch, vsapi, src, cmask, &bmap, &roi);
+        free(buff);
+
+        set_motion_props(ch, vsapi, cmask, n, &stats);
     }
 
     vsapi->freeFrame(src);
 
-    vsapi->propSetInt(vsapi->getFramePropsRW(cmask), "_Combed",
-                      ch->is_combed(ch, cmask, vsapi), paReplace);
+    int is_combed = ch->is_combed(ch, cmask, vsapi, &roi);
+    if (is_combed < 0) {
+        vsapi->freeFrame(cmask);
+        vsapi->setFilterError("CombMask: failed to allocate column sums.",
+                              frame_ctx);
+        return NULL;
+    }
+    if ((ch->from_luma[1] || ch->from_luma[2]) &&
+        !ch->mask_from_luma(ch, cmask, vsapi)) {
+        vsapi->freeFrame(cmask);
+        vsapi->setFilterError("CombMask: failed to allocate chroma buffer.",
+                              frame_ctx);
+        return NULL;
+    }
+    if (ch->history) {
+        ch->history[n] = is_combed != 0;
+    }
+    vsapi->propSetInt(vsapi->getFramePropsRW(cmask), "_Combed", is_combed,
+                      paReplace);
 
-    return cmask;
+    return output_mask(ch, cmask, core, vsapi);
 }
 
 
@@ -118,7 +318,7 @@ init_combmask(VSMap *in, VSMap *out, void **instance_data, VSNode *node,
               VSCore *core, const VSAPI *vsapi)
 {
     combmask_t *ch = (combmask_t *)*instance_data;
-    vsapi->setVideoInfo(ch->vi, 1, node);
+    vsapi->setVideoInfo(&ch->out_vi, 1, node);
     vsapi->clearMap(in);
 }
 
@@ -134,6 +334,8 @@ close_combmask(void *instance_data, VSCore *core, const VSAPI *vsapi)
         vsapi->freeNode(ch->node);
         ch->node = NULL;
     }
+    free(ch->history);
+    vsapi->freeFrame(ch->blank);
     free(ch);
     ch = NULL;
 }
@@ -173,18 +375,98 @@ create_combmask(const VSMap *in, VSMap *out, void *user_data, VSCore *core,
     char err[256] = {0};
 
     set_param_int(&ch->cthresh, "cthresh", 6 * mag, 0, max, in, vsapi, err);
-    RET_IF_ERROR(err[0], "%s", err);
+    RET_IF_ERROR(err[0], "%.200s", err);
 
     set_param_int(&ch->mthresh, "mthresh", 9 * mag, 0, max, in, vsapi, err);
-    RET_IF_ERROR(err[0], "%s", err);
+    RET_IF_ERROR(err[0], "%.200s", err);
+
+    set_param_int(&ch->scthresh, "scthresh", 20 * mag, 0, max, in, vsapi,
+                  err);
+    RET_IF_ERROR(err[0], "%.200s", err);
+
+    set_param_int(&ch->blockx, "blockx", 8, 4, 256, in, vsapi, err);
+    RET_IF_ERROR(err[0], "%.200s", err);
+
+    set_param_int(&ch->blocky, "blocky", 16, 4, 256, in, vsapi, err);
+    RET_IF_ERROR(err[0], "%.200s", err);
+
+    set_param_int(&ch->stepx, "stepx", ch->blockx, 1, ch->blockx, in, vsapi,
+                  err);
+    RET_IF_ERROR(err[0], "%.200s", err);
 
-    set_param_int(&ch->mi, "mi", 40, 0, 128, in, vsapi, err);
-    RET_IF_ERROR(err[0], "%s", err);
+    set_param_int(&ch->stepy, "stepy", ch->blocky, 1, ch->blocky, in, vsapi,
+                  err);
+    RET_IF_ERROR(err[0], "%.200s", err);
+
+    int max_mi = ch->blockx * ch->blocky > 128 ? ch->blockx * ch->blocky : 128;
+    set_param_int(&ch->mi, "mi", 40, 0, max_mi, in, vsapi, err);
+    RET_IF_ERROR(err[0], "%.200s", err);
 
     if (ch->vi->numFrames == 1) {
         ch->mthresh = 0;
     }
 
+    int max_crop = ch->vi->height / 2 - 4 > 0 ? ch->vi->height / 2 - 4 : 0;
+    set_param_int(&ch->croptop, "croptop", 0, 0, max_crop, in, vsapi, err);
+    RET_IF_ERROR(err[0], "%.200s", err);
+
+    set_param_int(&ch->cropbottom, "cropbottom", 0, 0, max_crop, in, vsapi,
+                  err);
+    RET_IF_ERROR(err[0], "%.200s", err);
+
+    set_param_int(&ch->letterbox, "letterbox", 0, 0, 1, in, vsapi, err);
+    RET_IF_ERROR(err[0], "%.200s", err);
+
+    set_param_int(&ch->field, "field", -1, -1, 1, in, vsapi, err);
+    RET_IF_ERROR(err[0], "%.200s", err);
+
+    int lumachroma;
+    set_param_int(&lumachroma, "lumachroma", 0, 0, 1, in, vsapi, err);
+    RET_IF_ERROR(err[0], "%.200s", err);
+    if (lumachroma) {
+        RET_IF_ERROR(ch->vi->format->colorFamily != cmYUV,
+                     "lumachroma requires a YUV clip.");
+        RET_IF_ERROR(!ch->planes[0], "lumachroma requires plane 0 in planes.");
+        for (int i = 1; i < 3; i++) {
+            ch->from_luma[i] = ch->planes[i];
+            ch->planes[i] = 0;
+        }
+    }
+
+    int cadence;
+    set_param_int(&cadence, "cadence", 0, 0, 1, in, vsapi, err);
+    RET_IF_ERROR(err[0], "%.200s", err);
+    if (cadence) {
+        RET_IF_ERROR(ch->vi->numFrames == 0,
+                     "cadence=1 requires a clip of known length.");
+        ch->history = (int8_t *)malloc(ch->vi->numFrames);
+        RET_IF_ERROR(!ch->history, "failed to allocate history.");
+        memset(ch->history, -1, ch->vi->numFrames);
+    }
+
+    set_param_int(&ch->trust, "trust", 0, 0, TRUST_COMBED | TRUST_FIELD_BASED,
+                  in, vsapi, err);
+    RET_IF_ERROR(err[0], "%.200s", err);
+
+    int output;
+    set_param_int(&output, "output", 0, 0, OUTPUT_8BIT | OUTPUT_GRAY, in,
+                  vsapi, err);
+    RET_IF_ERROR(err[0], "%.200s", err);
+    const VSFormat *fi = ch->vi->format;
+    int gray = (output & OUTPUT_GRAY) && fi->numPlanes > 1;
+    RET_IF_ERROR(gray && (ch->planes[1] || ch->planes[2] ||
+                          ch->from_luma[1] || ch->from_luma[2]),
+                 "output=%d requires planes=[0].", output);
+    ch->out_vi = *ch->vi;
+    if (gray || ((output & OUTPUT_8BIT) && fi->bitsPerSample > 8)) {
+        ch->out_vi.format = vsapi->registerFormat(
+            gray ? cmGray : fi->colorFamily, stInteger,
+            (output & OUTPUT_8BIT) ? 8 : fi->bitsPerSample,
+            gray ? 0 : fi->subSamplingW, gray ? 0 : fi->subSamplingH, core);
+    }
+
+    ch->blank = create_blank_mask(&ch->out_vi, core, vsapi);
+
     int func_index = ch->vi->format->bytesPerSample - 1;
     if (ch->vi->format->bitsPerSample == 16) {
         func_index = 2;
@@ -192,11 +474,20 @@ create_combmask(const VSMap *in, VSMap *out, void *user_data, VSCore *core,
 
     ch->write_combmask = write_combmask_funcs[func_index];
     ch->write_motionmask = write_motionmask_funcs[func_index];
-    ch->is_combed = is_combed_funcs[func_index];
+    if (ch->blockx == 8 && ch->blocky == 16 && ch->stepx == 8 &&
+        ch->stepy == 16) {
+        ch->is_combed = is_combed_funcs[func_index];
+    } else {
+        ch->is_combed = is_combed_window_funcs[func_index];
+    }
+    ch->is_flat = is_flat_funcs[func_index];
     ch->horizontal_dilation = h_dilation_funcs[func_index];
+    ch->mask_from_luma = mask_from_luma_funcs[func_index];
 
+    // the cadence history is updated by each frame and read by later ones.
     vsapi->createFilter(in, out, "CombMask", init_combmask, get_frame_combmask,
-                        close_combmask, fmParallel, 0, ch, core);
+                        close_combmask, ch->history ? fmUnordered : fmParallel,
+                        0, ch, core);
 
 #undef RET_IF_ERROR
 }
@@ -317,15 +608,33 @@ create_maskedmerge(const VSMap *in, VSMap *out, void *user_data, VSCore *core,
 
     mh->altc = vsapi->propGetNode(in, "alt", 0, 0);
     is_valid_node(mh->vi, vsapi->getVideoInfo(mh->altc), "alt", err);
-    RET_IF_ERROR(err[0], "%s", err);
-
-    mh->mask = vsapi->propGetNode(in, "mask", 0, 0);
-    is_valid_node(mh->vi, vsapi->getVideoInfo(mh->mask), "mask", err);
-    RET_IF_ERROR(err[0], "%s", err);
+    RET_IF_ERROR(err[0], "%.200s", err);
 
     RET_IF_ERROR(set_planes(mh->planes, in, vsapi),
                  "planes index out of range");
 
+    // the mask can also be 8bit and/or gray (CombMask(output)) as long as
+    // its plane for each processed plane has the same size.
+    mh->mask = vsapi->propGetNode(in, "mask", 0, 0);
+    const VSVideoInfo *mvi = vsapi->getVideoInfo(mh->mask);
+    const VSFormat *fb = mh->vi->format;
+    const VSFormat *fm = mvi->format;
+    RET_IF_ERROR(mvi->width != mh->vi->width || mvi->height != mh->vi->height,
+                 "base and mask are not the same resolution.");
+    RET_IF_ERROR(!fm || fm->sampleType != stInteger ||
+                 (fm->bitsPerSample != 8 &&
+                  fm->bitsPerSample != fb->bitsPerSample),
+                 "mask must be 8bit or the same bit depth as base.");
+    for (int p = 0; p < fb->numPlanes; p++) {
+        mh->mask_planes[p] = p < fm->numPlanes ? p : 0;
+        int ssw = p > 0 ? fb->subSamplingW : 0;
+        int ssh = p > 0 ? fb->subSamplingH : 0;
+        int mssw = mh->mask_planes[p] > 0 ? fm->subSamplingW : 0;
+        int mssh = mh->mask_planes[p] > 0 ? fm->subSamplingH : 0;
+        RET_IF_ERROR(mh->planes[p] && (ssw != mssw || ssh != mssh),
+                     "mask has no plane of the same size as plane %d.", p);
+    }
+
     vsapi->createFilter(in, out, "CMaskedMerge", init_maskedmerge,
                         get_frame_maskedmerge, close_maskedmerge, fmParallel,
                         0, mh, core);
@@ -342,9 +651,25 @@ VapourSynthPluginInit(VSConfigPlugin conf, VSRegisterFunction reg,
          "comb filters v"
          COMBMASK_VERSION, VAPOURSYNTH_API_VERSION, 1, plugin);
     reg("CombMask",
-        "clip:clip;cthresh:int:opt;mthresh:int:opt;mi:int:opt;planes:int[]:opt;",
+        "clip:clip;cthresh:int:opt;mthresh:int:opt;mi:int:opt;planes:int[]:opt;"
+        "blockx:int:opt;blocky:int:opt;stepx:int:opt;stepy:int:opt;"
+        "scthresh:int:opt;cadence:int:opt;trust:int:opt;croptop:int:opt;"
+        "cropbottom:int:opt;letterbox:int:opt;field:int:opt;"
+        "lumachroma:int:opt;output:int:opt;",
         create_combmask, NULL, plugin);
     reg("CMaskedMerge",
         "base:clip;alt:clip;mask:clip;planes:int[]:opt;", create_maskedmerge,
         NULL, plugin);
+    reg("CombStats",
+        "clip:clip;cthresh:int[]:opt;mthresh:int[]:opt;mi:int[]:opt;"
+        "plane:int:opt;blockx:int:opt;blocky:int:opt;",
+        create_combstats, NULL, plugin);
+    reg("CombMatch",
+        "clip:clip;field:int:opt;cthresh:int:opt;mi:int:opt;plane:int:opt;"
+        "blockx:int:opt;blocky:int:opt;",
+        create_combmatch, NULL, plugin);
+    reg("Calibrate",
+        "clip:clip;samples:int:opt;plane:int:opt;blockx:int:opt;blocky:int:opt;"
+        "cache:data:opt;",
+        create_calibrate, NULL, plugin);
 }
\ No newline at end of file
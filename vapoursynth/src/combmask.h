@@ -24,7 +24,11 @@
 #ifndef VS_COMBMASK_H
 #define VS_COMBMASK_H
 
+#if defined(__ARM_NEON)
+#include "sse2_neon.h"
+#else
 #include <emmintrin.h>
+#endif
 #include "VapourSynth.h"
 
 #define COMBMASK_VERSION "0.0.1"
@@ -42,30 +46,115 @@
 #define CM_FUNC_ALIGN
 #endif
 
+/* for the small SIMD helpers of the inner loops, which -Os would not inline */
+#if defined(_MSC_VER)
+#define CM_FORCEINLINE __forceinline
+#elif defined(__GNUC__)
+#define CM_FORCEINLINE inline __attribute__((always_inline))
+#else
+#define CM_FORCEINLINE inline
+#endif
+
+/* relaxed loads and stores of the ints which are shared by the threads of
+   fmParallel filters. a thread sees a value which another thread stored,
+   but no order between the values is guaranteed. */
+#if defined(__GNUC__)
+#define CM_LOAD_RELAXED(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define CM_STORE_RELAXED(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#else
+/* aligned int accesses through volatile are atomic on the MSVC targets. */
+#define CM_LOAD_RELAXED(p) (*(volatile const int *)(p))
+#define CM_STORE_RELAXED(p, v) (*(volatile int *)(p) = (v))
+#endif
+
+/* the vectors of the column strips of the loops over the lines of a plane.
+   the lines which are reused by the next lines stay in L2 on frames wider
+   than 8K. */
+#define STRIP_WIDTH 512
+
+/* upstream props trusted by CombMask(trust) */
+#define TRUST_COMBED      1 /* _Combed=0 means the frame is clean */
+#define TRUST_FIELD_BASED 2 /* _FieldBased=0 means the frame is progressive */
+
+/* compact formats of the mask returned by CombMask(output) */
+#define OUTPUT_8BIT 1 /* 8bit mask for 9-16bit clips */
+#define OUTPUT_GRAY 2 /* luma plane only */
+
 typedef struct combmask combmask_t;
 
 typedef struct maskedmerge maskedmerge_t;
 
+/* one byte per 16x16 block of each plane, nonzero if the block has motion */
+typedef struct block_map {
+    uint8_t *map[3];
+    int stride[3];
+} block_map_t;
+
+/* the active picture area, [top, bottom) lines of the first plane. the mask
+   is zero out of it. */
+typedef struct roi {
+    int top;
+    int bottom;
+} roi_t;
+
+/* sum of |src - prev| and number of moving pixels, byproducts of motion mask */
+typedef struct motion_stats {
+    uint64_t sad;
+    uint64_t moving;
+    uint64_t pixels;
+} motion_stats_t;
+
 typedef void (VS_CC *func_write_combmask)(combmask_t *ch, const VSAPI *vsapi,
                                            const VSFrameRef *src,
-                                           VSFrameRef *cmask);
+                                           VSFrameRef *cmask,
+                                           const block_map_t *bmap,
+                                           const roi_t *roi);
+
+typedef void (VS_CC *func_write_combrow)(int cthresh, int width,
+                                          const uint8_t *a, const uint8_t *b,
+                                          const uint8_t *c, const uint8_t *d,
+                                          const uint8_t *e, uint8_t *dst);
 
-typedef void (VS_CC *func_adapt_motion)(combmask_t *ch, const VSAPI *vsapi,
-                                         const VSFrameRef *src,
-                                         const VSFrameRef *prev,
-                                         VSFrameRef *cmask);
+/* returns 0 if it fails to allocate its buffer. */
+typedef int (VS_CC *func_adapt_motion)(combmask_t *ch, const VSAPI *vsapi,
+                                        const VSFrameRef *src,
+                                        const VSFrameRef *prev,
+                                        VSFrameRef *cmask,
+                                        block_map_t *bmap,
+                                        const roi_t *roi,
+                                        motion_stats_t *stats);
+
+/* returns 0 if it fails to allocate its buffer. */
+typedef int (VS_CC *func_motion_stats)(combmask_t *ch, const VSAPI *vsapi,
+                                        const VSFrameRef *src,
+                                        const VSFrameRef *prev,
+                                        const roi_t *roi,
+                                        motion_stats_t *stats);
 
 typedef void (VS_CC *func_write_motionmask)(int mthresh, int width,
-                                             int height, int stride,
+                                             int height, int stride, int rem,
                                              __m128i *maskp, __m128i *srcp,
-                                             __m128i *prevp);
+                                             __m128i *prevp,
+                                             motion_stats_t *stats);
 
+/* returns -1 if it fails to allocate its buffer. */
 typedef int (VS_CC *func_is_combed)(combmask_t *ch, VSFrameRef *cmask,
-                                     const VSAPI *vsapi);
+                                     const VSAPI *vsapi, const roi_t *roi);
+
+typedef int (VS_CC *func_is_flat)(combmask_t *ch, const VSAPI *vsapi,
+                                  const VSFrameRef *src);
 
 typedef void (VS_CC *func_h_dilation)(combmask_t *ch, VSFrameRef *cmask,
                                        const VSAPI *vsapi);
 
+/* returns 0 if it fails to allocate its buffer. */
+typedef int (VS_CC *func_mask_from_luma)(combmask_t *ch, VSFrameRef *cmask,
+                                          const VSAPI *vsapi);
+
+typedef void (VS_CC *func_narrow_mask)(const VSFrameRef *src,
+                                        VSFrameRef *dst, int plane,
+                                        const VSAPI *vsapi);
+
 typedef void (VS_CC *func_merge_frames)(maskedmerge_t *mh, const VSAPI *vsapi,
                                          const VSFrameRef *mask,
                                          const VSFrameRef *alt,
@@ -75,14 +164,42 @@ typedef void (VS_CC *func_merge_frames)(maskedmerge_t *mh, const VSAPI *vsapi,
 struct combmask {
     VSNodeRef *node;
     const VSVideoInfo *vi;
+    /* the format of the returned masks. the stages work on vi->format. */
+    VSVideoInfo out_vi;
     int planes[3];
     int cthresh;
     int mthresh;
     int mi;
+    int scthresh;
+    int blockx;
+    int blocky;
+    int stepx;
+    int stepy;
+    int croptop;
+    int cropbottom;
+    int letterbox;
+    /* the chroma planes whose masks are made from the luma mask. these are
+       not in planes[]. */
+    int from_luma[3];
+    /* the parity of the lines on which combs are evaluated, or -1 for both. */
+    int field;
+    /* the band of 16 rows where the last combed block was found. this is
+       only a hint for the scan order of is_combed, so the threads share it
+       with CM_LOAD_RELAXED/CM_STORE_RELAXED: a stale band changes the time
+       the scan takes, not its result. */
+    int hot_band;
+    /* _Combed of each frame for cadence=1 (-1 is unknown), or NULL. */
+    int8_t *history;
+    /* TRUST_* flags of the upstream props which can skip the detection. */
+    int trust;
+    /* the empty mask with _Combed=0 returned for the skipped frames. */
+    const VSFrameRef *blank;
     func_write_combmask write_combmask;
     func_write_motionmask write_motionmask;
     func_is_combed is_combed;
+    func_is_flat is_flat;
     func_h_dilation horizontal_dilation;
+    func_mask_from_luma mask_from_luma;
 };
 
 struct maskedmerge {
@@ -91,15 +208,51 @@ struct maskedmerge {
     VSNodeRef *mask;
     const VSVideoInfo *vi;
     int planes[3];
+    /* the plane of mask used for each plane. */
+    int mask_planes[3];
 };
 
 
 extern const func_adapt_motion      adapt_motion;
+extern const func_motion_stats      motion_stats;
 extern const func_write_combmask    write_combmask_funcs[];
 extern const func_write_motionmask  write_motionmask_funcs[];
 extern const func_is_combed         is_combed_funcs[];
+extern const func_is_combed         is_combed_window_funcs[];
+extern const func_is_flat           is_flat_funcs[];
 extern const func_h_dilation        h_dilation_funcs[];
+extern const func_mask_from_luma    mask_from_luma_funcs[];
 extern const func_merge_frames      merge_frames;
+extern const func_narrow_mask       narrow_mask;
+extern const func_write_combrow     write_combrow;
+
+void VS_CC get_roi(const combmask_t *ch, const VSAPI *vsapi,
+                   const VSFrameRef *src, roi_t *roi);
+
+int VS_CC predict_cadence(const combmask_t *ch, int n);
+
+int VS_CC verify_clean(const combmask_t *ch, const VSAPI *vsapi,
+                       const VSFrameRef *src, const VSFrameRef *prev);
+
+void VS_CC create_combstats(const VSMap *in, VSMap *out, void *user_data,
+                            VSCore *core, const VSAPI *vsapi);
+
+void VS_CC create_combmatch(const VSMap *in, VSMap *out, void *user_data,
+                            VSCore *core, const VSAPI *vsapi);
+
+void VS_CC create_calibrate(const VSMap *in, VSMap *out, void *user_data,
+                            VSCore *core, const VSAPI *vsapi);
+
+
+/* returns the number of the lines of plane p in roi, and sets the first one
+   to top. */
+static inline int
+roi_lines(const roi_t *roi, const VSFormat *fi, int p, int *top)
+{
+    int ss = p > 0 ? fi->subSamplingH : 0;
+    *top = roi->top >> ss;
+    return ((roi->bottom + (1 << ss) - 1) >> ss) - *top;
+}
 
 
 #ifdef USE_ALIGNED_MALLOC
@@ -22,8 +22,6 @@
 
 
 #include <string.h>
-#include <emmintrin.h>
-
 #define USE_ALIGNED_MALLOC
 #include "combmask.h"
 
@@ -21,7 +21,8 @@
 */
 
 
-#include <emmintrin.h>
+#include <string.h>
+#define USE_ALIGNED_MALLOC
 #include "combmask.h"
 
 #ifdef _MSC_VER
@@ -30,15 +31,54 @@
 #define CM_ALIGN __attribute__((aligned(16)))
 #endif
 
+/*
+ The plane is scanned in bands of 16 rows, starting from the band where the
+ previous frame was found to be combed (ch->hot_band). Each band is split into
+ regions of REGION vectors, and the blocks of a region are checked only when
+ the total of the region exceeds mi, since no block can have more combed
+ pixels than the region which contains it. The result doesn't depend on the
+ order of the scan.
+*/
+#define REGION 4
+
+
+static inline int hadd_epi64(__m128i x)
+{
+    return _mm_cvtsi128_si32(_mm_add_epi64(x, _mm_srli_si128(x, 8)));
+}
+
+
+static inline int start_band(combmask_t *ch, int first, int height)
+{
+    int band = CM_LOAD_RELAXED(&ch->hot_band);
+    return band > first && band < height ? band : first;
+}
+
+
+/* the bands from *first to the return value have any lines in roi. */
+static inline int
+roi_bands(combmask_t *ch, VSFrameRef *cmask, const VSAPI *vsapi,
+          const roi_t *roi, int p, int *first)
+{
+    int top;
+    int lines = roi_lines(roi, ch->vi->format, p, &top);
+    int height = vsapi->getFrameHeight(cmask, p) / 16;
+    int last = (top + lines + 15) / 16;
+    *first = top / 16;
+    return last < height ? last : height;
+}
+
 
 static int CM_FUNC_ALIGN VS_CC
-is_combed_8bit(combmask_t *ch, VSFrameRef *cmask, const VSAPI *vsapi)
+is_combed_8bit(combmask_t *ch, VSFrameRef *cmask, const VSAPI *vsapi,
+               const roi_t *roi)
 {
     int mi = ch->mi;
     int p = ch->planes[0] ? 0 : ch->planes[1] ? 1 : 2;
 
     int width = vsapi->getFrameWidth(cmask, p) / 16;
-    int height = vsapi->getFrameHeight(cmask, p) / 16;
+    int first;
+    int height = roi_bands(ch, cmask, vsapi, roi, p, &first);
     int stride_0 = vsapi->getStride(cmask, p) / 16;
     int stride_1 = stride_0 * 16;
 
@@ -50,28 +90,48 @@ is_combed_8bit(combmask_t *ch, VSFrameRef *cmask, const VSAPI *vsapi)
 
     CM_ALIGN int64_t array[2];
     __m128i *arr = (__m128i *)array;
+    __m128i sums[REGION];
 
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            __m128i sum = zero;
+    int y = start_band(ch, first, height);
 
-            for (int i = 0; i < 16; i++) {
-                // 0xFF == -1, thus the range of each bytes of sum is -16 to 0.
-                __m128i xmm0 = _mm_load_si128(srcp + x + stride_0 * i);
-                sum = _mm_add_epi8(sum, xmm0);
+    for (int n = first; n < height; n++, y++) {
+        if (y == height) {
+            y = first;
+        }
+        const __m128i *s = srcp + y * stride_1;
+
+        for (int x0 = 0; x0 < width; x0 += REGION) {
+            int num = width - x0 < REGION ? width - x0 : REGION;
+            __m128i total = zero;
+
+            for (int x = 0; x < num; x++) {
+                __m128i sum = zero;
+
+                for (int i = 0; i < 16; i++) {
+                    // 0xFF == -1, thus the range of each bytes of sum is -16 to 0.
+                    __m128i xmm0 = _mm_load_si128(s + x0 + x + stride_0 * i);
+                    sum = _mm_add_epi8(sum, xmm0);
+                }
+
+                sum = _mm_xor_si128(sum, all1);
+                sum = _mm_add_epi8(sum, one);       // -x = ~x + 1
+                sums[x] = _mm_sad_epu8(sum, zero);
+                total = _mm_add_epi64(total, sums[x]);
             }
 
-            sum = _mm_xor_si128(sum, all1);
-            sum = _mm_add_epi8(sum, one);       // -x = ~x + 1
-            sum = _mm_sad_epu8(sum, zero);
-            _mm_store_si128(arr, sum);
+            if (hadd_epi64(total) <= mi) {
+                continue;
+            }
 
-            if (array[0] > mi || array[1] > mi) {
-                ch->horizontal_dilation(ch, cmask, vsapi);
-                return 1;
+            for (int x = 0; x < num; x++) {
+                _mm_store_si128(arr, sums[x]);
+                if (array[0] > mi || array[1] > mi) {
+                    CM_STORE_RELAXED(&ch->hot_band, y);
+                    ch->horizontal_dilation(ch, cmask, vsapi);
+                    return 1;
+                }
             }
         }
-        srcp += stride_1;
     }
 
     return 0;
@@ -79,13 +139,15 @@ is_combed_8bit(combmask_t *ch, VSFrameRef *cmask, const VSAPI *vsapi)
 
 
 static int CM_FUNC_ALIGN VS_CC
-is_combed_9_10(combmask_t *ch, VSFrameRef *cmask, const VSAPI *vsapi)
+is_combed_9_10(combmask_t *ch, VSFrameRef *cmask, const VSAPI *vsapi,
+               const roi_t *roi)
 {
     int mi = ch->mi;
     int p = ch->planes[0] ? 0 : ch->planes[1] ? 1 : 2;
 
     int width = vsapi->getFrameWidth(cmask, p) / 8;
-    int height = vsapi->getFrameHeight(cmask, p) / 16;
+    int first;
+    int height = roi_bands(ch, cmask, vsapi, roi, p, &first);
     int stride_0 = vsapi->getStride(cmask, p) / 16;
     int stride_1 = stride_0 * 16;
 
@@ -94,28 +156,45 @@ is_combed_9_10(combmask_t *ch, VSFrameRef *cmask, const VSAPI *vsapi)
     __m128i zero = _mm_setzero_si128();
     __m128i one = _mm_srli_epi16(_mm_cmpeq_epi32(zero, zero), 15);
 
-    CM_ALIGN int64_t array[2];
-    __m128i *arr = (__m128i *)array;
+    __m128i sums[REGION];
 
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            __m128i sum = zero;
+    int y = start_band(ch, first, height);
+
+    for (int n = first; n < height; n++, y++) {
+        if (y == height) {
+            y = first;
+        }
+        const __m128i *s = srcp + y * stride_1;
 
-            for (int i = 0; i < 16; i++) {
-                __m128i xmm0 = _mm_load_si128(srcp + x + stride_0 * i);
-                xmm0 = _mm_and_si128(xmm0, one);
-                sum = _mm_add_epi16(sum, xmm0);
+        for (int x0 = 0; x0 < width; x0 += REGION) {
+            int num = width - x0 < REGION ? width - x0 : REGION;
+            __m128i total = zero;
+
+            for (int x = 0; x < num; x++) {
+                __m128i sum = zero;
+
+                for (int i = 0; i < 16; i++) {
+                    __m128i xmm0 = _mm_load_si128(s + x0 + x + stride_0 * i);
+                    xmm0 = _mm_and_si128(xmm0, one);
+                    sum = _mm_add_epi16(sum, xmm0);
+                }
+
+                sums[x] = _mm_sad_epu8(sum, zero);
+                total = _mm_add_epi64(total, sums[x]);
             }
 
-            sum = _mm_sad_epu8(sum, zero);
-            _mm_store_si128(arr, sum);
+            if (hadd_epi64(total) <= mi) {
+                continue;
+            }
 
-            if (array[0] + array[1] > mi) {
-                ch->horizontal_dilation(ch, cmask, vsapi);
-                return 1;
+            for (int x = 0; x < num; x++) {
+                if (hadd_epi64(sums[x]) > mi) {
+                    CM_STORE_RELAXED(&ch->hot_band, y);
+                    ch->horizontal_dilation(ch, cmask, vsapi);
+                    return 1;
+                }
             }
         }
-        srcp += stride_1;
     }
 
     return 0;
@@ -123,13 +202,15 @@ is_combed_9_10(combmask_t *ch, VSFrameRef *cmask, const VSAPI *vsapi)
 
 
 static int CM_FUNC_ALIGN VS_CC
-is_combed_16bit(combmask_t *ch, VSFrameRef *cmask, const VSAPI *vsapi)
+is_combed_16bit(combmask_t *ch, VSFrameRef *cmask, const VSAPI *vsapi,
+                const roi_t *roi)
 {
     int mi = ch->mi;
     int p = ch->planes[0] ? 0 : ch->planes[1] ? 1 : 2;
 
     int width = vsapi->getFrameWidth(cmask, p) / 8;
-    int height = vsapi->getFrameHeight(cmask, p) / 16;
+    int first;
+    int height = roi_bands(ch, cmask, vsapi, roi, p, &first);
     int stride_0 = vsapi->getStride(cmask, p) / 16;
     int stride_1 = stride_0 * 16;
 
@@ -139,38 +220,199 @@ is_combed_16bit(combmask_t *ch, VSFrameRef *cmask, const VSAPI *vsapi)
     __m128i all1 = _mm_cmpeq_epi32(zero, zero);
     __m128i one = _mm_srli_epi16(all1, 15);
 
-    CM_ALIGN int64_t array[2];
-    __m128i *arr = (__m128i *)array;
+    __m128i sums[REGION];
 
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            __m128i sum = zero;
+    int y = start_band(ch, first, height);
+
+    for (int n = first; n < height; n++, y++) {
+        if (y == height) {
+            y = first;
+        }
+        const __m128i *s = srcp + y * stride_1;
+
+        for (int x0 = 0; x0 < width; x0 += REGION) {
+            int num = width - x0 < REGION ? width - x0 : REGION;
+            __m128i total = zero;
+
+            for (int x = 0; x < num; x++) {
+                __m128i sum = zero;
 
-            for (int i = 0; i < 16; i++) {
-                // 0xFFFF == -1, thus the range of each 2bytes of sum is -16 to 0.
-                __m128i xmm0 = _mm_load_si128(srcp + x + stride_0 * i);
-                sum = _mm_add_epi16(sum, xmm0);
+                for (int i = 0; i < 16; i++) {
+                    // 0xFFFF == -1, thus the range of each 2bytes of sum is -16 to 0.
+                    __m128i xmm0 = _mm_load_si128(s + x0 + x + stride_0 * i);
+                    sum = _mm_add_epi16(sum, xmm0);
+                }
+
+                sum = _mm_xor_si128(sum, all1);
+                sum = _mm_add_epi16(sum, one);       // -x = ~x + 1
+                sums[x] = _mm_sad_epu8(sum, zero);
+                total = _mm_add_epi64(total, sums[x]);
             }
 
-            sum = _mm_xor_si128(sum, all1);
-            sum = _mm_add_epi16(sum, one);       // -x = ~x + 1
-            sum = _mm_sad_epu8(sum, zero);
-            _mm_store_si128(arr, sum);
+            if (hadd_epi64(total) <= mi) {
+                continue;
+            }
 
-            if (array[0] + array[1] > mi) {
-                ch->horizontal_dilation(ch, cmask, vsapi);
-                return 1;
+            for (int x = 0; x < num; x++) {
+                if (hadd_epi64(sums[x]) > mi) {
+                    CM_STORE_RELAXED(&ch->hot_band, y);
+                    ch->horizontal_dilation(ch, cmask, vsapi);
+                    return 1;
+                }
             }
         }
-        srcp += stride_1;
     }
 
     return 0;
 }
 
 
+/*
+ Blocks of any size and step (blockx, blocky, stepx and stepy of CombMask).
+ colsum holds the count of each column over the blocky lines of the current
+ line of blocks, and is moved down by adding the lines which enter the window
+ and subtracting the lines which leave it. The count of a block is the
+ difference of two prefix sums of colsum, thus a block costs O(1) whatever
+ its size and overlap.
+*/
+typedef void (*func_accumulate)(int16_t *colsum, const uint8_t *srcp,
+                                int stride, int width, int lines, int sub);
+
+
+static void CM_FUNC_ALIGN
+accumulate_8bit(int16_t *colsum, const uint8_t *srcp, int stride, int width,
+                int lines, int sub)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i one = _mm_set1_epi16(1);
+
+    for (int y = 0; y < lines; y++) {
+        for (int x = 0; x < width; x += 16) {
+            __m128i *c = (__m128i *)(colsum + x);
+            __m128i xmm0 = _mm_load_si128((__m128i *)(srcp + x));
+            __m128i lo = _mm_and_si128(_mm_unpacklo_epi8(xmm0, zero), one);
+            __m128i hi = _mm_and_si128(_mm_unpackhi_epi8(xmm0, zero), one);
+            if (sub) {
+                c[0] = _mm_sub_epi16(c[0], lo);
+                c[1] = _mm_sub_epi16(c[1], hi);
+            } else {
+                c[0] = _mm_add_epi16(c[0], lo);
+                c[1] = _mm_add_epi16(c[1], hi);
+            }
+        }
+        srcp += stride;
+    }
+}
+
+
+static void CM_FUNC_ALIGN
+accumulate_16bit(int16_t *colsum, const uint8_t *srcp, int stride, int width,
+                 int lines, int sub)
+{
+    __m128i one = _mm_set1_epi16(1);
+
+    for (int y = 0; y < lines; y++) {
+        const __m128i *s = (const __m128i *)srcp;
+        for (int x = 0; x < width; x += 8) {
+            __m128i *c = (__m128i *)(colsum + x);
+            __m128i xmm0 = _mm_and_si128(_mm_load_si128(s + x / 8), one);
+            *c = sub ? _mm_sub_epi16(*c, xmm0) : _mm_add_epi16(*c, xmm0);
+        }
+        srcp += stride;
+    }
+}
+
+
+static int
+is_combed_window(combmask_t *ch, VSFrameRef *cmask, const VSAPI *vsapi,
+                 const roi_t *roi, func_accumulate accumulate)
+{
+    int mi = ch->mi;
+    int blockx = ch->blockx;
+    int blocky = ch->blocky;
+    int stepx = ch->stepx;
+    int stepy = ch->stepy;
+    int p = ch->planes[0] ? 0 : ch->planes[1] ? 1 : 2;
+
+    int width = vsapi->getFrameWidth(cmask, p);
+    int height = vsapi->getFrameHeight(cmask, p);
+    int stride = vsapi->getStride(cmask, p);
+
+    // the windows which end above roi or start below it have nothing.
+    int top;
+    int bottom = roi_lines(roi, ch->vi->format, p, &top);
+    bottom += top;
+    int first = top < blocky ? 0 : (top - blocky + stepy) / stepy * stepy;
+
+    const uint8_t *srcp = vsapi->getReadPtr(cmask, p);
+
+    int colsize = (width + 15) / 16 * 16;
+    int16_t *colsum = (int16_t *)_aligned_malloc(
+        colsize * sizeof(int16_t) + (width + 1) * sizeof(int32_t), 16);
+    if (!colsum) {
+        return -1;
+    }
+    int32_t *prefix = (int32_t *)(colsum + colsize);
+    prefix[0] = 0;
+
+    int combed = 0;
+
+    for (int y = first; y + blocky <= height && y < bottom && !combed;
+            y += stepy) {
+        if (y == first || stepy >= blocky) {
+            memset(colsum, 0, colsize * sizeof(int16_t));
+            accumulate(colsum, srcp + y * stride, stride, width, blocky, 0);
+        } else {
+            accumulate(colsum, srcp + (y - stepy) * stride, stride, width,
+                       stepy, 1);
+            accumulate(colsum, srcp + (y + blocky - stepy) * stride, stride,
+                       width, stepy, 0);
+        }
+
+        for (int x = 0; x < width; x++) {
+            prefix[x + 1] = prefix[x] + colsum[x];
+        }
+        for (int x = 0; x + blockx <= width; x += stepx) {
+            if (prefix[x + blockx] - prefix[x] > mi) {
+                combed = 1;
+                break;
+            }
+        }
+    }
+
+    _aligned_free(colsum);
+
+    if (combed) {
+        ch->horizontal_dilation(ch, cmask, vsapi);
+    }
+    return combed;
+}
+
+
+static int VS_CC
+is_combed_window_8bit(combmask_t *ch, VSFrameRef *cmask, const VSAPI *vsapi,
+                      const roi_t *roi)
+{
+    return is_combed_window(ch, cmask, vsapi, roi, accumulate_8bit);
+}
+
+
+static int VS_CC
+is_combed_window_16bit(combmask_t *ch, VSFrameRef *cmask, const VSAPI *vsapi,
+                       const roi_t *roi)
+{
+    return is_combed_window(ch, cmask, vsapi, roi, accumulate_16bit);
+}
+
+
 const func_is_combed is_combed_funcs[] = {
     is_combed_8bit,
     is_combed_9_10,
     is_combed_16bit
 };
+
+const func_is_combed is_combed_window_funcs[] = {
+    is_combed_window_8bit,
+    is_combed_window_16bit,
+    is_combed_window_16bit
+};
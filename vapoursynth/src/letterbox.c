@@ -0,0 +1,113 @@
+/*
+  letterbox.c: Copyright (C) 2012-2013  Oka Motofumi
+
+  Author: Oka Motofumi (chikuzen.mo at gmail dot com)
+
+  This file is part of CombMask.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with the author; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#include "combmask.h"
+
+/* luma level of letterbox bars in 8bit. */
+#define BAR_LEVEL 24
+
+
+/* returns 1 if no pixel of the rows from y0 to y1 - 1 exceeds level. */
+static int
+dark_rows(const uint8_t *srcp, int stride, int width, int bytes, int level,
+          int y0, int y1)
+{
+    int vwidth = (width * bytes) & ~15;
+    __m128i zero = _mm_setzero_si128();
+    __m128i xlvl = bytes == 1 ? _mm_set1_epi8((int8_t)level)
+                              : _mm_set1_epi16((int16_t)level);
+
+    for (int y = y0; y < y1; y++) {
+        const uint8_t *row = srcp + y * stride;
+        __m128i over = zero;
+        for (int x = 0; x < vwidth; x += 16) {
+            __m128i xmm0 = _mm_load_si128((const __m128i *)(row + x));
+            xmm0 = bytes == 1 ? _mm_subs_epu8(xmm0, xlvl)
+                              : _mm_subs_epu16(xmm0, xlvl);
+            over = _mm_or_si128(over, xmm0);
+        }
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(over, zero)) != 0xFFFF) {
+            return 0;
+        }
+        for (int x = vwidth / bytes; x < width; x++) {
+            int v = bytes == 1 ? row[x] : ((const uint16_t *)row)[x];
+            if (v > level) {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+
+/*
+ Sets the active picture area of src to roi: the frame without croptop and
+ cropbottom, and without the letterbox bars if letterbox=1. Bars are the dark
+ lines at the top and bottom of the first plane, up to a third of the height
+ each. Real bars are shorter than that, so a frame which is dark over a third
+ of its height on either side is taken as a dark picture (a fade to black) and
+ gets no bars. roi depends on src only.
+*/
+void VS_CC
+get_roi(const combmask_t *ch, const VSAPI *vsapi, const VSFrameRef *src,
+        roi_t *roi)
+{
+    int height = ch->vi->height;
+    roi->top = ch->croptop;
+    roi->bottom = height - ch->cropbottom;
+
+    if (!ch->letterbox) {
+        return;
+    }
+
+    int width = ch->vi->width;
+    int bytes = ch->vi->format->bytesPerSample;
+    int level = BAR_LEVEL << (ch->vi->format->bitsPerSample - 8);
+    int stride = vsapi->getStride(src, 0);
+    const uint8_t *srcp = vsapi->getReadPtr(src, 0);
+
+    int max_bar = height / 3;
+    int top, bottom;
+    for (top = 0; top < max_bar; top++) {
+        if (!dark_rows(srcp, stride, width, bytes, level, top, top + 1)) {
+            break;
+        }
+    }
+    for (bottom = height; bottom > height - max_bar; bottom--) {
+        if (!dark_rows(srcp, stride, width, bytes, level, bottom - 1,
+                       bottom)) {
+            break;
+        }
+    }
+    if (top == max_bar || bottom == height - max_bar) {
+        return;
+    }
+
+    if (top > roi->top) {
+        roi->top = top;
+    }
+    if (bottom < roi->bottom) {
+        roi->bottom = bottom;
+    }
+}
@@ -0,0 +1,183 @@
+/*
+  luma_chroma.c: Copyright (C) 2012-2013  Oka Motofumi
+
+  Author: Oka Motofumi (chikuzen.mo at gmail dot com)
+
+  This file is part of CombMask.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with the author; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+
+#define USE_ALIGNED_MALLOC
+#include "combmask.h"
+
+/*
+ CombMask(lumachroma=1) doesn't detect combs on the chroma planes. Instead,
+ a pixel of their masks is the OR of the luma mask over its cell of
+ (1 << subSamplingW) x (1 << subSamplingH) pixels.
+*/
+
+
+/* ORs the rows of a cell into buff, which has width * 16 bytes. */
+static inline const __m128i *
+or_rows(const uint8_t *lumap, int lstride, int rows, int width, __m128i *buff)
+{
+    if (rows == 1) {
+        return (const __m128i *)lumap;
+    }
+    for (int x = 0; x < width; x++) {
+        __m128i xmm0 = _mm_load_si128((const __m128i *)lumap + x);
+        for (int i = 1; i < rows; i++) {
+            xmm0 = _mm_or_si128(xmm0, _mm_load_si128(
+                (const __m128i *)(lumap + i * lstride) + x));
+        }
+        _mm_store_si128(buff + x, xmm0);
+    }
+    return buff;
+}
+
+
+static int CM_FUNC_ALIGN VS_CC
+mask_from_luma_8bit(combmask_t *ch, VSFrameRef *cmask, const VSAPI *vsapi)
+{
+    const VSFormat *fi = ch->vi->format;
+    int ssw = fi->subSamplingW;
+    int rows = 1 << fi->subSamplingH;
+    int lstride = vsapi->getStride(cmask, 0);
+    int lwidth = (vsapi->getFrameWidth(cmask, 0) + 31) / 32 * 2;
+    __m128i *buff = (__m128i *)_aligned_malloc(lwidth * 16, 16);
+    if (!buff) {
+        return 0;
+    }
+
+    for (int p = 1; p < fi->numPlanes; p++) {
+        if (ch->from_luma[p] == 0) {
+            continue;
+        }
+
+        const uint8_t *lumap = vsapi->getReadPtr(cmask, 0);
+        uint8_t *dstp = vsapi->getWritePtr(cmask, p);
+        int stride = vsapi->getStride(cmask, p);
+        int width = vsapi->getFrameWidth(cmask, p);
+        int height = vsapi->getFrameHeight(cmask, p);
+
+        for (int y = 0; y < height; y++) {
+            const __m128i *l = or_rows(lumap, lstride, rows, lwidth, buff);
+            if (ssw == 0) {
+                for (int x = 0; x < width; x += 16) {
+                    _mm_store_si128((__m128i *)(dstp + x), l[x / 16]);
+                }
+            } else if (ssw == 1) {
+                // the mask is 0 or 255, so the OR of a pair is the high byte
+                // of (w | w << 8) as a signed word.
+                for (int x = 0; x < width; x += 16) {
+                    __m128i xmm0 = _mm_load_si128(l + x / 8);
+                    __m128i xmm1 = _mm_load_si128(l + x / 8 + 1);
+                    xmm0 = _mm_or_si128(xmm0, _mm_slli_epi16(xmm0, 8));
+                    xmm1 = _mm_or_si128(xmm1, _mm_slli_epi16(xmm1, 8));
+                    xmm0 = _mm_packs_epi16(_mm_srai_epi16(xmm0, 8),
+                                           _mm_srai_epi16(xmm1, 8));
+                    _mm_store_si128((__m128i *)(dstp + x), xmm0);
+                }
+            } else {
+                const uint8_t *lp = (const uint8_t *)l;
+                for (int x = 0; x < width; x++) {
+                    uint8_t v = 0;
+                    for (int i = 0; i < 1 << ssw; i++) {
+                        v |= lp[(x << ssw) + i];
+                    }
+                    dstp[x] = v;
+                }
+            }
+            lumap += lstride * rows;
+            dstp += stride;
+        }
+    }
+
+    _aligned_free(buff);
+    return 1;
+}
+
+
+static int CM_FUNC_ALIGN VS_CC
+mask_from_luma_16bit(combmask_t *ch, VSFrameRef *cmask, const VSAPI *vsapi)
+{
+    const VSFormat *fi = ch->vi->format;
+    int ssw = fi->subSamplingW;
+    int rows = 1 << fi->subSamplingH;
+    int lstride = vsapi->getStride(cmask, 0);
+    int lwidth = (vsapi->getFrameWidth(cmask, 0) + 15) / 16 * 2;
+    __m128i *buff = (__m128i *)_aligned_malloc(lwidth * 16, 16);
+    if (!buff) {
+        return 0;
+    }
+
+    for (int p = 1; p < fi->numPlanes; p++) {
+        if (ch->from_luma[p] == 0) {
+            continue;
+        }
+
+        const uint8_t *lumap = vsapi->getReadPtr(cmask, 0);
+        uint16_t *dstp = (uint16_t *)vsapi->getWritePtr(cmask, p);
+        int stride = vsapi->getStride(cmask, p) / 2;
+        int width = vsapi->getFrameWidth(cmask, p);
+        int height = vsapi->getFrameHeight(cmask, p);
+
+        for (int y = 0; y < height; y++) {
+            const __m128i *l = or_rows(lumap, lstride, rows, lwidth, buff);
+            if (ssw == 0) {
+                for (int x = 0; x < width; x += 8) {
+                    _mm_store_si128((__m128i *)(dstp + x), l[x / 8]);
+                }
+            } else if (ssw == 1) {
+                // the low word of (d | d >> 16), sign extended to keep
+                // 0xFFFF through packs.
+                for (int x = 0; x < width; x += 8) {
+                    __m128i xmm0 = _mm_load_si128(l + x / 4);
+                    __m128i xmm1 = _mm_load_si128(l + x / 4 + 1);
+                    xmm0 = _mm_or_si128(xmm0, _mm_srli_epi32(xmm0, 16));
+                    xmm1 = _mm_or_si128(xmm1, _mm_srli_epi32(xmm1, 16));
+                    xmm0 = _mm_srai_epi32(_mm_slli_epi32(xmm0, 16), 16);
+                    xmm1 = _mm_srai_epi32(_mm_slli_epi32(xmm1, 16), 16);
+                    _mm_store_si128((__m128i *)(dstp + x),
+                                    _mm_packs_epi32(xmm0, xmm1));
+                }
+            } else {
+                const uint16_t *lp = (const uint16_t *)l;
+                for (int x = 0; x < width; x++) {
+                    uint16_t v = 0;
+                    for (int i = 0; i < 1 << ssw; i++) {
+                        v |= lp[(x << ssw) + i];
+                    }
+                    dstp[x] = v;
+                }
+            }
+            lumap += lstride * rows;
+            dstp += stride;
+        }
+    }
+
+    _aligned_free(buff);
+    return 1;
+}
+
+
+const func_mask_from_luma mask_from_luma_funcs[] = {
+    mask_from_luma_8bit,
+    mask_from_luma_16bit,
+    mask_from_luma_16bit
+};
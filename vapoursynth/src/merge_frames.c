@@ -21,10 +21,27 @@
 */
 
 
-#include <emmintrin.h>
 #include "combmask.h"
 
 
+/* merges 16-bit words of a 16 pixels span with an 8bit mask. */
+static inline void
+merge_16_8(__m128i *dstp, const __m128i *altp, const __m128i *maskp)
+{
+    __m128i xmm2 = _mm_load_si128(maskp);
+    for (int i = 0; i < 2; i++) {
+        __m128i xmm0 = _mm_load_si128(dstp + i);
+        __m128i xmm1 = _mm_load_si128(altp + i);
+        __m128i xmm3 = i == 0 ? _mm_unpacklo_epi8(xmm2, xmm2)
+                              : _mm_unpackhi_epi8(xmm2, xmm2);
+
+        xmm0 = _mm_andnot_si128(xmm3, xmm0);
+        xmm1 = _mm_and_si128(xmm3, xmm1);
+        _mm_store_si128(dstp + i, _mm_or_si128(xmm0, xmm1));
+    }
+}
+
+
 static void CM_FUNC_ALIGN VS_CC
 merge_frames_all(maskedmerge_t *mh, const VSAPI *vsapi, const VSFrameRef *mask,
                  const VSFrameRef *alt, VSFrameRef *dst)
@@ -37,34 +54,44 @@ merge_frames_all(maskedmerge_t *mh, const VSAPI *vsapi, const VSFrameRef *mask,
     }
 
     int adjust = 16 / mh->vi->format->bytesPerSample;
+    int narrow = vsapi->getFrameFormat(mask)->bytesPerSample <
+                 mh->vi->format->bytesPerSample;
 
     for (int p = 0; p < mh->vi->format->numPlanes; p++) {
         if (mh->planes[p] == 0) {
             continue;
         }
 
+        int mp = mh->mask_planes[p];
         const __m128i *altp = (__m128i *)vsapi->getReadPtr(alt, p);
-        const __m128i *maskp = (__m128i *)vsapi->getReadPtr(mask, p);
+        const __m128i *maskp = (__m128i *)vsapi->getReadPtr(mask, mp);
         __m128i *dstp = (__m128i *)vsapi->getWritePtr(dst, p);
 
         int width = (vsapi->getFrameWidth(dst, p) + adjust - 1) / adjust;
         int height = vsapi->getFrameHeight(dst, p);
-        int stride = vsapi->getStride(dst, p) / adjust;
+        int stride = vsapi->getStride(dst, p) / 16;
+        int mstride = vsapi->getStride(mask, mp) / 16;
 
         for (int y = 0; y < height; y++) {
-            for (int x = 0; x < width; x++) {
-                __m128i xmm0 = _mm_load_si128(dstp + x);
-                __m128i xmm1 = _mm_load_si128(altp + x);
-                __m128i xmm2 = _mm_load_si128(maskp + x);
-
-                xmm0 = _mm_andnot_si128(xmm2, xmm0);
-                xmm1 = _mm_and_si128(xmm2, xmm1);
-                xmm0 = _mm_or_si128(xmm0, xmm1);
-
-                _mm_store_si128(dstp + x, xmm0);
+            if (narrow) {
+                for (int x = 0; x < width; x += 2) {
+                    merge_16_8(dstp + x, altp + x, maskp + x / 2);
+                }
+            } else {
+                for (int x = 0; x < width; x++) {
+                    __m128i xmm0 = _mm_load_si128(dstp + x);
+                    __m128i xmm1 = _mm_load_si128(altp + x);
+                    __m128i xmm2 = _mm_load_si128(maskp + x);
+
+                    xmm0 = _mm_andnot_si128(xmm2, xmm0);
+                    xmm1 = _mm_and_si128(xmm2, xmm1);
+                    xmm0 = _mm_or_si128(xmm0, xmm1);
+
+                    _mm_store_si128(dstp + x, xmm0);
+                }
             }
             altp += stride;
-            maskp += stride;
+            maskp += mstride;
             dstp += stride;
         }
     }
@@ -0,0 +1,57 @@
+/*
+  output_mask.c: Copyright (C) 2012-2013  Oka Motofumi
+
+  Author: Oka Motofumi (chikuzen.mo at gmail dot com)
+
+  This file is part of CombMask.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with the author; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+
+#include "combmask.h"
+
+
+/* writes 255 to dst where the 9-16bit mask of src is not 0. */
+static void CM_FUNC_ALIGN VS_CC
+narrow_mask_16bit(const VSFrameRef *src, VSFrameRef *dst, int plane,
+                  const VSAPI *vsapi)
+{
+    const __m128i *srcp = (const __m128i *)vsapi->getReadPtr(src, plane);
+    __m128i *dstp = (__m128i *)vsapi->getWritePtr(dst, plane);
+    int sstride = vsapi->getStride(src, plane) / 16;
+    int dstride = vsapi->getStride(dst, plane) / 16;
+    int width = (vsapi->getFrameWidth(dst, plane) + 15) / 16;
+    int height = vsapi->getFrameHeight(dst, plane);
+
+    __m128i zero = _mm_setzero_si128();
+    __m128i all1 = _mm_cmpeq_epi32(zero, zero);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            __m128i xmm0 = _mm_load_si128(srcp + 2 * x);
+            __m128i xmm1 = _mm_load_si128(srcp + 2 * x + 1);
+            xmm0 = _mm_packs_epi16(_mm_cmpeq_epi16(xmm0, zero),
+                                   _mm_cmpeq_epi16(xmm1, zero));
+            _mm_store_si128(dstp + x, _mm_xor_si128(xmm0, all1));
+        }
+        srcp += sstride;
+        dstp += dstride;
+    }
+}
+
+
+const func_narrow_mask narrow_mask = narrow_mask_16bit;
@@ -0,0 +1,374 @@
+/*
+  sse2_neon.h: Copyright (C) 2012-2013  Oka Motofumi
+
+  Author: Oka Motofumi (chikuzen.mo at gmail dot com)
+
+  This file is part of CombMask.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with the author; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+/*
+ The SSE2 intrinsics used by CombMask, written with NEON for AArch64. Only
+ these are provided, and each one gives the same result as SSE2 for all
+ inputs, so the routines need no changes and the masks are identical.
+ Shift counts may be variables, as vshlq takes them in a vector.
+*/
+
+#ifndef VS_COMBMASK_SSE2_NEON_H
+#define VS_COMBMASK_SSE2_NEON_H
+
+#include <stdint.h>
+#include <arm_neon.h>
+
+typedef int64x2_t __m128i;
+
+#define U8(x)  vreinterpretq_u8_s64(x)
+#define S8(x)  vreinterpretq_s8_s64(x)
+#define U16(x) vreinterpretq_u16_s64(x)
+#define S16(x) vreinterpretq_s16_s64(x)
+#define U32(x) vreinterpretq_u32_s64(x)
+#define S32(x) vreinterpretq_s32_s64(x)
+#define U64(x) vreinterpretq_u64_s64(x)
+#define M_U8(x)  vreinterpretq_s64_u8(x)
+#define M_S8(x)  vreinterpretq_s64_s8(x)
+#define M_U16(x) vreinterpretq_s64_u16(x)
+#define M_S16(x) vreinterpretq_s64_s16(x)
+#define M_U32(x) vreinterpretq_s64_u32(x)
+#define M_S32(x) vreinterpretq_s64_s32(x)
+#define M_U64(x) vreinterpretq_s64_u64(x)
+
+
+static inline __m128i _mm_load_si128(const __m128i *p)
+{
+    return vld1q_s64((const int64_t *)p);
+}
+
+static inline __m128i _mm_loadu_si128(const __m128i *p)
+{
+    return M_U8(vld1q_u8((const uint8_t *)p));
+}
+
+static inline void _mm_store_si128(__m128i *p, __m128i a)
+{
+    vst1q_s64((int64_t *)p, a);
+}
+
+static inline void _mm_storeu_si128(__m128i *p, __m128i a)
+{
+    vst1q_u8((uint8_t *)p, U8(a));
+}
+
+static inline __m128i _mm_setzero_si128(void)
+{
+    return vdupq_n_s64(0);
+}
+
+static inline __m128i _mm_set1_epi8(int8_t a)
+{
+    return M_S8(vdupq_n_s8(a));
+}
+
+static inline __m128i _mm_set1_epi16(int16_t a)
+{
+    return M_S16(vdupq_n_s16(a));
+}
+
+static inline __m128i _mm_set1_epi32(int32_t a)
+{
+    return M_S32(vdupq_n_s32(a));
+}
+
+static inline __m128i
+_mm_setr_epi8(int8_t b0, int8_t b1, int8_t b2, int8_t b3, int8_t b4,
+              int8_t b5, int8_t b6, int8_t b7, int8_t b8, int8_t b9,
+              int8_t b10, int8_t b11, int8_t b12, int8_t b13, int8_t b14,
+              int8_t b15)
+{
+    int8_t v[16] = {b0, b1, b2, b3, b4, b5, b6, b7, b8, b9, b10, b11, b12,
+                    b13, b14, b15};
+    return M_S8(vld1q_s8(v));
+}
+
+static inline __m128i
+_mm_setr_epi16(int16_t w0, int16_t w1, int16_t w2, int16_t w3, int16_t w4,
+               int16_t w5, int16_t w6, int16_t w7)
+{
+    int16_t v[8] = {w0, w1, w2, w3, w4, w5, w6, w7};
+    return M_S16(vld1q_s16(v));
+}
+
+static inline int _mm_cvtsi128_si32(__m128i a)
+{
+    return vgetq_lane_s32(S32(a), 0);
+}
+
+
+static inline __m128i _mm_and_si128(__m128i a, __m128i b)
+{
+    return vandq_s64(a, b);
+}
+
+static inline __m128i _mm_or_si128(__m128i a, __m128i b)
+{
+    return vorrq_s64(a, b);
+}
+
+static inline __m128i _mm_xor_si128(__m128i a, __m128i b)
+{
+    return veorq_s64(a, b);
+}
+
+/* ~a & b */
+static inline __m128i _mm_andnot_si128(__m128i a, __m128i b)
+{
+    return vbicq_s64(b, a);
+}
+
+
+static inline __m128i _mm_add_epi8(__m128i a, __m128i b)
+{
+    return M_S8(vaddq_s8(S8(a), S8(b)));
+}
+
+static inline __m128i _mm_add_epi16(__m128i a, __m128i b)
+{
+    return M_S16(vaddq_s16(S16(a), S16(b)));
+}
+
+static inline __m128i _mm_add_epi32(__m128i a, __m128i b)
+{
+    return M_S32(vaddq_s32(S32(a), S32(b)));
+}
+
+static inline __m128i _mm_add_epi64(__m128i a, __m128i b)
+{
+    return vaddq_s64(a, b);
+}
+
+static inline __m128i _mm_sub_epi16(__m128i a, __m128i b)
+{
+    return M_S16(vsubq_s16(S16(a), S16(b)));
+}
+
+static inline __m128i _mm_sub_epi32(__m128i a, __m128i b)
+{
+    return M_S32(vsubq_s32(S32(a), S32(b)));
+}
+
+static inline __m128i _mm_subs_epu8(__m128i a, __m128i b)
+{
+    return M_U8(vqsubq_u8(U8(a), U8(b)));
+}
+
+static inline __m128i _mm_subs_epu16(__m128i a, __m128i b)
+{
+    return M_U16(vqsubq_u16(U16(a), U16(b)));
+}
+
+static inline __m128i _mm_adds_epu16(__m128i a, __m128i b)
+{
+    return M_U16(vqaddq_u16(U16(a), U16(b)));
+}
+
+static inline __m128i _mm_min_epi16(__m128i a, __m128i b)
+{
+    return M_S16(vminq_s16(S16(a), S16(b)));
+}
+
+static inline __m128i _mm_max_epi16(__m128i a, __m128i b)
+{
+    return M_S16(vmaxq_s16(S16(a), S16(b)));
+}
+
+static inline __m128i _mm_min_epu8(__m128i a, __m128i b)
+{
+    return M_U8(vminq_u8(U8(a), U8(b)));
+}
+
+static inline __m128i _mm_max_epu8(__m128i a, __m128i b)
+{
+    return M_U8(vmaxq_u8(U8(a), U8(b)));
+}
+
+/* sums of the products of adjacent words */
+static inline __m128i _mm_madd_epi16(__m128i a, __m128i b)
+{
+    int32x4_t lo = vmull_s16(vget_low_s16(S16(a)), vget_low_s16(S16(b)));
+    int32x4_t hi = vmull_high_s16(S16(a), S16(b));
+    return M_S32(vpaddq_s32(lo, hi));
+}
+
+/* sums of absolute differences of each 8 bytes, in the 64bit lanes */
+static inline __m128i _mm_sad_epu8(__m128i a, __m128i b)
+{
+    uint8x16_t d = vabdq_u8(U8(a), U8(b));
+    return M_U64(vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(d))));
+}
+
+
+static inline __m128i _mm_cmpeq_epi8(__m128i a, __m128i b)
+{
+    return M_U8(vceqq_s8(S8(a), S8(b)));
+}
+
+static inline __m128i _mm_cmpeq_epi16(__m128i a, __m128i b)
+{
+    return M_U16(vceqq_s16(S16(a), S16(b)));
+}
+
+static inline __m128i _mm_cmpeq_epi32(__m128i a, __m128i b)
+{
+    return M_U32(vceqq_s32(S32(a), S32(b)));
+}
+
+static inline __m128i _mm_cmpgt_epi8(__m128i a, __m128i b)
+{
+    return M_U8(vcgtq_s8(S8(a), S8(b)));
+}
+
+static inline __m128i _mm_cmpgt_epi16(__m128i a, __m128i b)
+{
+    return M_U16(vcgtq_s16(S16(a), S16(b)));
+}
+
+static inline __m128i _mm_cmpgt_epi32(__m128i a, __m128i b)
+{
+    return M_U32(vcgtq_s32(S32(a), S32(b)));
+}
+
+static inline __m128i _mm_cmplt_epi16(__m128i a, __m128i b)
+{
+    return M_U16(vcltq_s16(S16(a), S16(b)));
+}
+
+static inline __m128i _mm_cmplt_epi32(__m128i a, __m128i b)
+{
+    return M_U32(vcltq_s32(S32(a), S32(b)));
+}
+
+
+static inline __m128i _mm_unpacklo_epi8(__m128i a, __m128i b)
+{
+    return M_S8(vzip1q_s8(S8(a), S8(b)));
+}
+
+static inline __m128i _mm_unpackhi_epi8(__m128i a, __m128i b)
+{
+    return M_S8(vzip2q_s8(S8(a), S8(b)));
+}
+
+static inline __m128i _mm_unpacklo_epi16(__m128i a, __m128i b)
+{
+    return M_S16(vzip1q_s16(S16(a), S16(b)));
+}
+
+static inline __m128i _mm_unpackhi_epi16(__m128i a, __m128i b)
+{
+    return M_S16(vzip2q_s16(S16(a), S16(b)));
+}
+
+static inline __m128i _mm_unpacklo_epi32(__m128i a, __m128i b)
+{
+    return M_S32(vzip1q_s32(S32(a), S32(b)));
+}
+
+static inline __m128i _mm_unpackhi_epi32(__m128i a, __m128i b)
+{
+    return M_S32(vzip2q_s32(S32(a), S32(b)));
+}
+
+static inline __m128i _mm_packs_epi16(__m128i a, __m128i b)
+{
+    return M_S8(vcombine_s8(vqmovn_s16(S16(a)), vqmovn_s16(S16(b))));
+}
+
+static inline __m128i _mm_packs_epi32(__m128i a, __m128i b)
+{
+    return M_S16(vcombine_s16(vqmovn_s32(S32(a)), vqmovn_s32(S32(b))));
+}
+
+
+/* counts over the lane size give 0, or the sign on the arithmetic shifts,
+   as SSE2 does. */
+static inline __m128i _mm_slli_epi16(__m128i a, int n)
+{
+    n = n > 16 ? 16 : n;
+    return M_U16(vshlq_u16(U16(a), vdupq_n_s16((int16_t)n)));
+}
+
+static inline __m128i _mm_srli_epi16(__m128i a, int n)
+{
+    n = n > 16 ? 16 : n;
+    return M_U16(vshlq_u16(U16(a), vdupq_n_s16((int16_t)-n)));
+}
+
+static inline __m128i _mm_srai_epi16(__m128i a, int n)
+{
+    n = n > 16 ? 16 : n;
+    return M_S16(vshlq_s16(S16(a), vdupq_n_s16((int16_t)-n)));
+}
+
+static inline __m128i _mm_slli_epi32(__m128i a, int n)
+{
+    n = n > 32 ? 32 : n;
+    return M_U32(vshlq_u32(U32(a), vdupq_n_s32(n)));
+}
+
+static inline __m128i _mm_srli_epi32(__m128i a, int n)
+{
+    n = n > 32 ? 32 : n;
+    return M_U32(vshlq_u32(U32(a), vdupq_n_s32(-n)));
+}
+
+static inline __m128i _mm_srai_epi32(__m128i a, int n)
+{
+    n = n > 32 ? 32 : n;
+    return M_S32(vshlq_s32(S32(a), vdupq_n_s32(-n)));
+}
+
+/* the count of vextq has to be a constant, thus this is a macro. */
+#define _mm_srli_si128(a, imm) \
+    vreinterpretq_s64_u8(vextq_u8(vreinterpretq_u8_s64(a), vdupq_n_u8(0), \
+                                  (imm)))
+
+/* the sign bits are weighted by their positions and summed per half. */
+static inline int _mm_movemask_epi8(__m128i a)
+{
+    static const uint8_t weights[16] = {
+        1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128
+    };
+    uint8x16_t sign = vreinterpretq_u8_s8(vshrq_n_s8(S8(a), 7));
+    uint8x16_t t = vandq_u8(sign, vld1q_u8(weights));
+    return vaddv_u8(vget_low_u8(t)) | (vaddv_u8(vget_high_u8(t)) << 8);
+}
+
+#undef U8
+#undef S8
+#undef U16
+#undef S16
+#undef U32
+#undef S32
+#undef U64
+#undef M_U8
+#undef M_S8
+#undef M_U16
+#undef M_S16
+#undef M_U32
+#undef M_S32
+#undef M_U64
+
+#endif // VS_COMBMASK_SSE2_NEON_H
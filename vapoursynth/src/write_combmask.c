@@ -22,14 +22,167 @@
 
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
-#include <emmintrin.h>
 #include "combmask.h"
 
 
+/* the line y of a plane of height lines, mirrored at its edges. */
+static inline int mirror_line(int y, int height)
+{
+    return y < 0 ? -y : y < height ? y : 2 * (height - 1) - y;
+}
+
+
+/* with field=0/1, the comb metric is only evaluated on the lines of one
+   parity, starting at first. each line of the other parity gets the mask of
+   the evaluated line next to it in the same pair. */
+static void
+copy_field(void *dstp, int stride, int height, int first)
+{
+    uint8_t *d = (uint8_t *)dstp;
+    for (int y = 1 - first; y < height; y += 2) {
+        int from = (y ^ 1) < height ? y ^ 1 : y - 1;
+        memcpy(d + y * stride, d + from * stride, stride);
+    }
+}
+
+
+/* the lines of the 8bit comb mask made at once by write_comb_rows_8bit. */
+#define COMB_ROWS 4
+
+
+/* 16 pixels of a line, as bytes and as the words of their halves. */
+typedef struct {
+    __m128i b;
+    __m128i lo;
+    __m128i hi;
+} comb_row_t;
+
+
+static CM_FORCEINLINE comb_row_t
+load_comb_row(const __m128i *p, __m128i zero)
+{
+    comb_row_t r;
+    r.b = _mm_load_si128(p);
+    r.lo = _mm_unpacklo_epi8(r.b, zero);
+    r.hi = _mm_unpackhi_epi8(r.b, zero);
+    return r;
+}
+
+
+/* comb mask of the 16 pixels of the line c, from the lines a to e. */
+static CM_FORCEINLINE __m128i
+comb_metric_rows(comb_row_t a, comb_row_t b, comb_row_t c, comb_row_t d,
+                 comb_row_t e, __m128i xcth, __m128i xct6, __m128i zero)
+{
+    __m128i xmm3 = _mm_subs_epu8(c.b, _mm_max_epu8(b.b, d.b));
+    xmm3 = _mm_cmpeq_epi8(zero, _mm_subs_epu8(xmm3, xcth)); // !(d1 > cthresh && d2 > cthresh)
+
+    __m128i xmm4 = _mm_subs_epu8(_mm_min_epu8(b.b, d.b), c.b);
+    xmm4 = _mm_cmpeq_epi8(zero, _mm_subs_epu8(xmm4, xcth)); // !(d1 < -cthresh && d2 < -cthresh)
+
+    xmm3 = _mm_and_si128(xmm3, xmm4);
+
+    xmm4 = _mm_add_epi16(b.lo, d.lo);                      // lo of (b+d)
+    __m128i xmm1 = _mm_add_epi16(b.hi, d.hi);              // hi of (b+d)
+    xmm4 = _mm_add_epi16(xmm4, _mm_add_epi16(xmm4, xmm4)); // lo of 3*(b+d)
+    xmm1 = _mm_add_epi16(xmm1, _mm_add_epi16(xmm1, xmm1)); // hi of 3*(b+d)
+
+    __m128i xmm5 = _mm_add_epi16(_mm_slli_epi16(c.lo, 2), a.lo);
+    __m128i xmm2 = _mm_add_epi16(_mm_slli_epi16(c.hi, 2), a.hi);
+    xmm5 = _mm_add_epi16(xmm5, e.lo);                      // lo of a+4*c+e
+    xmm2 = _mm_add_epi16(xmm2, e.hi);                      // hi of a+4*c+e
+
+    __m128i xmm0 = _mm_max_epi16(xmm4, xmm5);
+    xmm4 = _mm_min_epi16(xmm4, xmm5);
+    xmm0 = _mm_sub_epi16(xmm0, xmm4);
+    xmm0 = _mm_cmpgt_epi16(xmm0, xct6);
+
+    xmm4 = _mm_max_epi16(xmm1, xmm2);
+    xmm1 = _mm_min_epi16(xmm1, xmm2);
+    xmm4 = _mm_sub_epi16(xmm4, xmm1);
+    xmm4 = _mm_cmpgt_epi16(xmm4, xct6);
+
+    xmm1 = _mm_packs_epi16(xmm0, xmm4);
+
+    return _mm_andnot_si128(xmm3, xmm1);
+}
+
+
+/* comb mask of the 16 pixels at x of the line c, from the lines a to e. */
+static CM_FORCEINLINE __m128i
+comb_metric_8bit(const __m128i *a, const __m128i *b, const __m128i *c,
+                 const __m128i *d, const __m128i *e, int x, __m128i xcth,
+                 __m128i xct6, __m128i zero)
+{
+    return comb_metric_rows(load_comb_row(a + x, zero),
+                            load_comb_row(b + x, zero),
+                            load_comb_row(c + x, zero),
+                            load_comb_row(d + x, zero),
+                            load_comb_row(e + x, zero), xcth, xct6, zero);
+}
+
+
+/* stores the comb mask xmm3 to d, ANDed with the motion mask if any. */
+static CM_FORCEINLINE void
+store_comb(__m128i *d, __m128i xmm3, const uint8_t *mrow)
+{
+    if (mrow) {
+        xmm3 = _mm_and_si128(xmm3, _mm_load_si128(d));
+    }
+    _mm_store_si128(d, xmm3);
+}
+
+
+/*
+ COMB_ROWS lines of the vectors [x0, x1) from the line y, which share the
+ loads and the unpacking of their COMB_ROWS + 4 source lines. y is a multiple
+ of COMB_ROWS, so the lines are in one row of the block map.
+*/
+static inline void
+write_comb_rows_8bit(__m128i *dstp, const __m128i *srcp, int stride, int x0,
+                     int x1, int height, int y, const uint8_t *mrow,
+                     __m128i xcth, __m128i xct6, __m128i zero)
+{
+    const __m128i *s[COMB_ROWS + 4];
+    for (int i = 0; i < COMB_ROWS + 4; i++) {
+        s[i] = srcp + mirror_line(y - 2 + i, height) * stride;
+    }
+    __m128i *dstl = dstp + y * stride;
+
+    for (int x = x0; x < x1; x++) {
+        if (mrow && mrow[x] == 0) {
+            continue; // no motion, already cleared by adapt_motion
+        }
+        comb_row_t r0 = load_comb_row(s[0] + x, zero);
+        comb_row_t r1 = load_comb_row(s[1] + x, zero);
+        comb_row_t r2 = load_comb_row(s[2] + x, zero);
+        comb_row_t r3 = load_comb_row(s[3] + x, zero);
+        comb_row_t r4 = load_comb_row(s[4] + x, zero);
+        store_comb(dstl + x,
+                   comb_metric_rows(r0, r1, r2, r3, r4, xcth, xct6, zero),
+                   mrow);
+        comb_row_t r5 = load_comb_row(s[5] + x, zero);
+        store_comb(dstl + stride + x,
+                   comb_metric_rows(r1, r2, r3, r4, r5, xcth, xct6, zero),
+                   mrow);
+        comb_row_t r6 = load_comb_row(s[6] + x, zero);
+        store_comb(dstl + stride * 2 + x,
+                   comb_metric_rows(r2, r3, r4, r5, r6, xcth, xct6, zero),
+                   mrow);
+        comb_row_t r7 = load_comb_row(s[7] + x, zero);
+        store_comb(dstl + stride * 3 + x,
+                   comb_metric_rows(r3, r4, r5, r6, r7, xcth, xct6, zero),
+                   mrow);
+    }
+}
+
+
 static void CM_FUNC_ALIGN VS_CC
 write_combmask_8bit(combmask_t *ch, const VSAPI *vsapi, const VSFrameRef *src,
-                    VSFrameRef *cmask)
+                    VSFrameRef *cmask, const block_map_t *bmap,
+                    const roi_t *roi)
 {
     __m128i xcth = _mm_set1_epi8((int8_t)ch->cthresh);
     __m128i xct6 = _mm_set1_epi16((int16_t)(ch->cthresh * 6));
@@ -39,75 +192,64 @@ write_combmask_8bit(combmask_t *ch, const VSAPI *vsapi, const VSFrameRef *src,
 
         __m128i* dstp = (__m128i*)vsapi->getWritePtr(cmask, p);
 
-        int height = vsapi->getFrameHeight(src, p);
+        int plane_height = vsapi->getFrameHeight(src, p);
         int stride = vsapi->getStride(src, p) / 16;
+        int top;
+        int height = roi_lines(roi, ch->vi->format, p, &top);
 
         if (ch->planes[p] == 0 || height < 3) {
-            memset(dstp, 0, stride * height * 16);
+            memset(dstp, 0, stride * plane_height * 16);
             continue;
         }
 
-        int width = (vsapi->getFrameWidth(src, p) + 15) / 16;
+        // the lines out of roi
+        memset(dstp, 0, stride * top * 16);
+        memset(dstp + (top + height) * stride, 0,
+               stride * (plane_height - top - height) * 16);
+        dstp += top * stride;
 
-        const __m128i* srcpc = (__m128i*)vsapi->getReadPtr(src, p);
-        const __m128i* srcpb = srcpc + stride;
-        const __m128i* srcpa = srcpb + stride;
-        const __m128i* srcpd = srcpc + stride;
-        const __m128i* srcpe = srcpd + stride;
-
-        for (int y = 0; y < height; y++) {
-            for (int x = 0; x < width; x++) {
-                __m128i xmm0 = _mm_load_si128(srcpc + x);
-                __m128i xmm1 = _mm_load_si128(srcpb + x);
-                __m128i xmm2 = _mm_load_si128(srcpd + x);
-
-                __m128i xmm3 = _mm_subs_epu8(xmm0, _mm_max_epu8(xmm1, xmm2));
-                xmm3 = _mm_cmpeq_epi8(zero, _mm_subs_epu8(xmm3, xcth)); // !(d1 > cthresh && d2 > cthresh)
-
-                __m128i xmm4 = _mm_subs_epu8(_mm_min_epu8(xmm1, xmm2), xmm0);
-                xmm4 = _mm_cmpeq_epi8(zero, _mm_subs_epu8(xmm4, xcth)); // !(d1 < -cthresh && d2 < -cthresh)
-
-                xmm3 = _mm_and_si128(xmm3, xmm4);
-
-                xmm4 = _mm_add_epi16(_mm_unpacklo_epi8(xmm1, zero),
-                                     _mm_unpacklo_epi8(xmm2, zero)); // lo of (b+d)
-                xmm1 = _mm_add_epi16(_mm_unpackhi_epi8(xmm1, zero),
-                                     _mm_unpackhi_epi8(xmm2, zero)); // hi of (b+d)
-                xmm4 = _mm_add_epi16(xmm4, _mm_add_epi16(xmm4, xmm4));      // lo of 3*(b+d)
-                xmm1 = _mm_add_epi16(xmm1, _mm_add_epi16(xmm1, xmm1));      // hi of 3*(b+d)
-                
-                xmm2 = _mm_load_si128(srcpa + x);
-                __m128i xmm5 = _mm_add_epi16(_mm_slli_epi16(_mm_unpacklo_epi8(xmm0, zero), 2),
-                                             _mm_unpacklo_epi8(xmm2, zero));
-                xmm2 = _mm_add_epi16(_mm_slli_epi16(_mm_unpackhi_epi8(xmm0, zero), 2),
-                                     _mm_unpackhi_epi8(xmm2, zero));
-                
-                xmm0 = _mm_load_si128(srcpe + x);
-                xmm5 = _mm_add_epi16(xmm5, _mm_unpacklo_epi8(xmm0, zero));
-                xmm2 = _mm_add_epi16(xmm2, _mm_unpackhi_epi8(xmm0, zero));
-                
-                xmm0 = _mm_max_epi16(xmm4, xmm5);
-                xmm4 = _mm_min_epi16(xmm4, xmm5);
-                xmm0 = _mm_sub_epi16(xmm0, xmm4);
-                xmm0 = _mm_cmpgt_epi16(xmm0, xct6);
-                
-                xmm4 = _mm_max_epi16(xmm1, xmm2);
-                xmm1 = _mm_min_epi16(xmm1, xmm2);
-                xmm4 = _mm_sub_epi16(xmm4, xmm1);
-                xmm4 = _mm_cmpgt_epi16(xmm4, xct6);
-                
-                xmm1 = _mm_packs_epi16(xmm0, xmm4);
-
-                xmm3 = _mm_andnot_si128(xmm3, xmm1);
+        int width = (vsapi->getFrameWidth(src, p) + 15) / 16;
 
-                _mm_store_si128(dstp + x, xmm3);
+        const __m128i* srcp = (__m128i*)vsapi->getReadPtr(src, p);
+        srcp += top * stride;
+        int first = ch->field < 0 ? 0 : (ch->field ^ top) & 1;
+        int ystep = ch->field < 0 ? 1 : 2;
+
+        for (int x0 = 0; x0 < width; x0 += STRIP_WIDTH) {
+            int x1 = width - x0 > STRIP_WIDTH ? x0 + STRIP_WIDTH : width;
+            int y = first;
+            for (; ystep == 1 && y + COMB_ROWS <= height; y += COMB_ROWS) {
+                const uint8_t *mrow =
+                    bmap ? bmap->map[p] + (y >> 4) * bmap->stride[p] : NULL;
+                write_comb_rows_8bit(dstp, srcp, stride, x0, x1, height, y,
+                                     mrow, xcth, xct6, zero);
             }
-            dstp += stride;
-            srcpa = srcpb;
-            srcpb = srcpc;
-            srcpc = srcpd;
-            srcpd = srcpe;
-            srcpe = (y < height - 3) ? srcpe + stride : srcpe - stride;
+            for (; y < height; y += ystep) {
+                const __m128i* srcpa = srcp + mirror_line(y - 2, height) * stride;
+                const __m128i* srcpb = srcp + mirror_line(y - 1, height) * stride;
+                const __m128i* srcpc = srcp + y * stride;
+                const __m128i* srcpd = srcp + mirror_line(y + 1, height) * stride;
+                const __m128i* srcpe = srcp + mirror_line(y + 2, height) * stride;
+                __m128i* dstl = dstp + y * stride;
+                const uint8_t *mrow =
+                    bmap ? bmap->map[p] + (y >> 4) * bmap->stride[p] : NULL;
+                for (int x = x0; x < x1; x++) {
+                    if (mrow && mrow[x] == 0) {
+                        continue; // no motion, already cleared by adapt_motion
+                    }
+                    __m128i xmm3 = comb_metric_8bit(srcpa, srcpb, srcpc, srcpd,
+                                                    srcpe, x, xcth, xct6, zero);
+
+                    if (mrow) {
+                        xmm3 = _mm_and_si128(xmm3, _mm_load_si128(dstl + x));
+                    }
+
+                    _mm_store_si128(dstl + x, xmm3);
+                }
+            }
+        }
+        if (ystep == 2) {
+            copy_field(dstp, stride * 16, height, first);
         }
     }
 }
@@ -115,7 +257,8 @@ write_combmask_8bit(combmask_t *ch, const VSAPI *vsapi, const VSFrameRef *src,
 
 static void CM_FUNC_ALIGN VS_CC
 write_combmask_9_10(combmask_t *ch, const VSAPI *vsapi, const VSFrameRef *src,
-                    VSFrameRef *cmask)
+                    VSFrameRef *cmask, const block_map_t *bmap,
+                    const roi_t *roi)
 {
     __m128i xcth = _mm_set1_epi16((int16_t)ch->cthresh);
     __m128i xct6p = _mm_set1_epi32((int16_t)(ch->cthresh * 6));
@@ -126,62 +269,84 @@ write_combmask_9_10(combmask_t *ch, const VSAPI *vsapi, const VSFrameRef *src,
 
         __m128i* dstp = (__m128i*)vsapi->getWritePtr(cmask, p);
 
-        int height = vsapi->getFrameHeight(src, p);
+        int plane_height = vsapi->getFrameHeight(src, p);
         int stride = vsapi->getStride(cmask, p) / 16;
+        int top;
+        int height = roi_lines(roi, ch->vi->format, p, &top);
 
         if (ch->planes[p] == 0 || height < 3) {
-            memset(dstp, 0, stride * height * 16);
+            memset(dstp, 0, stride * plane_height * 16);
             continue;
         }
 
-        int width = (vsapi->getFrameWidth(src, p) + 7) / 8;
-
-        const __m128i* srcpc = (__m128i*)vsapi->getReadPtr(src, p);
-        const __m128i* srcpb = srcpc + stride;
-        const __m128i* srcpa = srcpb + stride;
-        const __m128i* srcpd = srcpc + stride;
-        const __m128i* srcpe = srcpd + stride;
-
-        for (int y = 0; y < height; y++) {
-            for (int x = 0; x < width; x++) {
-                __m128i xmm0 = _mm_load_si128(srcpc + x);
-                __m128i xmm1 = _mm_load_si128(srcpb + x);
-                __m128i xmm2 = _mm_load_si128(srcpd + x);
-
-                __m128i xmm3 = _mm_cmpgt_epi16(_mm_sub_epi16(xmm0, xmm1), xcth);
-                __m128i xmm4 = _mm_cmpgt_epi16(_mm_sub_epi16(xmm0, xmm2), xcth);
-                xmm3 = _mm_and_si128(xmm3, xmm4);
-
-                xmm4 = _mm_cmpgt_epi16(_mm_sub_epi16(xmm1, xmm0), xcth);
-                __m128i xmm5 = _mm_cmpgt_epi16(_mm_sub_epi16(xmm2, xmm0), xcth);
-                xmm4 = _mm_and_si128(xmm4, xmm5);
-
-                xmm3 = _mm_and_si128(xmm3, xmm4);
-
-                xmm1 = _mm_add_epi16(xmm1, xmm2); // b + d
-                xmm1 = _mm_add_epi16(xmm1, _mm_add_epi16(xmm1, xmm1)); //3 * (b + d)
-                xmm0 = _mm_slli_epi16(xmm0, 2); // 4 * c
-
-                xmm2 = _mm_add_epi16(_mm_load_si128(srcpa + x),
-                                     _mm_load_si128(srcpe + x)); // a + e
-                xmm0 = _mm_add_epi16(xmm0, xmm2); // a + 4 * c + e
-                xmm0 = _mm_sub_epi16(xmm0, xmm1); // a+4*c+e-3*(b+d)
-
-                xmm1 = _mm_cmpgt_epi16(xmm0, xct6p);
-                xmm0 = _mm_cmplt_epi16(xmm0, xct6n);
-
-                xmm0 = _mm_or_si128(xmm0, xmm1);
+        // the lines out of roi
+        memset(dstp, 0, stride * top * 16);
+        memset(dstp + (top + height) * stride, 0,
+               stride * (plane_height - top - height) * 16);
+        dstp += top * stride;
 
-                xmm0 = _mm_srli_epi16(_mm_and_si128(xmm0, xmm3), shift);
+        int width = (vsapi->getFrameWidth(src, p) + 7) / 8;
 
-                _mm_store_si128(dstp + x, xmm0);
+        const __m128i* srcp = (__m128i*)vsapi->getReadPtr(src, p);
+        srcp += top * stride;
+        int first = ch->field < 0 ? 0 : (ch->field ^ top) & 1;
+        int ystep = ch->field < 0 ? 1 : 2;
+
+        for (int x0 = 0; x0 < width; x0 += STRIP_WIDTH) {
+            int x1 = width - x0 > STRIP_WIDTH ? x0 + STRIP_WIDTH : width;
+            for (int y = first; y < height; y += ystep) {
+                const __m128i* srcpa = srcp + mirror_line(y - 2, height) * stride;
+                const __m128i* srcpb = srcp + mirror_line(y - 1, height) * stride;
+                const __m128i* srcpc = srcp + y * stride;
+                const __m128i* srcpd = srcp + mirror_line(y + 1, height) * stride;
+                const __m128i* srcpe = srcp + mirror_line(y + 2, height) * stride;
+                __m128i* dstl = dstp + y * stride;
+                const uint8_t *mrow =
+                    bmap ? bmap->map[p] + (y >> 4) * bmap->stride[p] : NULL;
+                for (int x = x0; x < x1; x++) {
+                    if (mrow && mrow[x >> 1] == 0) {
+                        continue; // no motion, already cleared by adapt_motion
+                    }
+                    __m128i xmm0 = _mm_load_si128(srcpc + x);
+                    __m128i xmm1 = _mm_load_si128(srcpb + x);
+                    __m128i xmm2 = _mm_load_si128(srcpd + x);
+
+                    __m128i xmm3 = _mm_cmpgt_epi16(_mm_sub_epi16(xmm0, xmm1), xcth);
+                    __m128i xmm4 = _mm_cmpgt_epi16(_mm_sub_epi16(xmm0, xmm2), xcth);
+                    xmm3 = _mm_and_si128(xmm3, xmm4);
+
+                    xmm4 = _mm_cmpgt_epi16(_mm_sub_epi16(xmm1, xmm0), xcth);
+                    __m128i xmm5 = _mm_cmpgt_epi16(_mm_sub_epi16(xmm2, xmm0), xcth);
+                    xmm4 = _mm_and_si128(xmm4, xmm5);
+
+                    xmm3 = _mm_and_si128(xmm3, xmm4);
+
+                    xmm1 = _mm_add_epi16(xmm1, xmm2); // b + d
+                    xmm1 = _mm_add_epi16(xmm1, _mm_add_epi16(xmm1, xmm1)); //3 * (b + d)
+                    xmm0 = _mm_slli_epi16(xmm0, 2); // 4 * c
+
+                    xmm2 = _mm_add_epi16(_mm_load_si128(srcpa + x),
+                                         _mm_load_si128(srcpe + x)); // a + e
+                    xmm0 = _mm_add_epi16(xmm0, xmm2); // a + 4 * c + e
+                    xmm0 = _mm_sub_epi16(xmm0, xmm1); // a+4*c+e-3*(b+d)
+
+                    xmm1 = _mm_cmpgt_epi16(xmm0, xct6p);
+                    xmm0 = _mm_cmplt_epi16(xmm0, xct6n);
+
+                    xmm0 = _mm_or_si128(xmm0, xmm1);
+
+                    xmm0 = _mm_srli_epi16(_mm_and_si128(xmm0, xmm3), shift);
+
+                    if (mrow) {
+                        xmm0 = _mm_and_si128(xmm0, _mm_load_si128(dstl + x));
+                    }
+
+                    _mm_store_si128(dstl + x, xmm0);
+                }
             }
-            dstp += stride;
-            srcpa = srcpb;
-            srcpb = srcpc;
-            srcpc = srcpd;
-            srcpd = srcpe;
-            srcpe = (y < height - 3) ? srcpe + stride : srcpe - stride;
+        }
+        if (ystep == 2) {
+            copy_field(dstp, stride * 16, height, first);
         }
     }
 }
@@ -189,7 +354,8 @@ write_combmask_9_10(combmask_t *ch, const VSAPI *vsapi, const VSFrameRef *src,
 
 static void CM_FUNC_ALIGN VS_CC
 write_combmask_16bit(combmask_t *ch, const VSAPI *vsapi, const VSFrameRef *src,
-                     VSFrameRef *cmask)
+                     VSFrameRef *cmask, const block_map_t *bmap,
+                     const roi_t *roi)
 {
     __m128i xcth = _mm_set1_epi16((int16_t)ch->cthresh);
     __m128i xct6p = _mm_set1_epi16((int16_t)(ch->cthresh * 6));
@@ -200,73 +366,211 @@ write_combmask_16bit(combmask_t *ch, const VSAPI *vsapi, const VSFrameRef *src,
 
         __m128i* dstp = (__m128i*)vsapi->getWritePtr(cmask, p);
 
-        int height = vsapi->getFrameHeight(src, p);
+        int plane_height = vsapi->getFrameHeight(src, p);
         int stride = vsapi->getStride(cmask, p) / 16;
+        int top;
+        int height = roi_lines(roi, ch->vi->format, p, &top);
 
         if (ch->planes[p] == 0 || height < 3) {
-            memset(dstp, 0, stride * height * 16);
+            memset(dstp, 0, stride * plane_height * 16);
             continue;
         }
 
+        // the lines out of roi
+        memset(dstp, 0, stride * top * 16);
+        memset(dstp + (top + height) * stride, 0,
+               stride * (plane_height - top - height) * 16);
+        dstp += top * stride;
+
         int width = (vsapi->getFrameWidth(src, p) + 7) / 8;
 
-        const __m128i* srcpc = (__m128i*)vsapi->getReadPtr(src, p);
-        const __m128i* srcpb = srcpc + stride;
-        const __m128i* srcpa = srcpb + stride;
-        const __m128i* srcpd = srcpc + stride;
-        const __m128i* srcpe = srcpd + stride;
-
-        for (int y = 0; y < height; y++) {
-            for (int x = 0; x < width; x++) {
-                __m128i xmm0 = _mm_load_si128(srcpc + x);
-                __m128i xmm1 = _mm_load_si128(srcpb + x);
-                __m128i xmm2 = _mm_load_si128(srcpd + x);
+        const __m128i* srcp = (__m128i*)vsapi->getReadPtr(src, p);
+        srcp += top * stride;
+        int first = ch->field < 0 ? 0 : (ch->field ^ top) & 1;
+        int ystep = ch->field < 0 ? 1 : 2;
+
+        for (int x0 = 0; x0 < width; x0 += STRIP_WIDTH) {
+            int x1 = width - x0 > STRIP_WIDTH ? x0 + STRIP_WIDTH : width;
+            for (int y = first; y < height; y += ystep) {
+                const __m128i* srcpa = srcp + mirror_line(y - 2, height) * stride;
+                const __m128i* srcpb = srcp + mirror_line(y - 1, height) * stride;
+                const __m128i* srcpc = srcp + y * stride;
+                const __m128i* srcpd = srcp + mirror_line(y + 1, height) * stride;
+                const __m128i* srcpe = srcp + mirror_line(y + 2, height) * stride;
+                __m128i* dstl = dstp + y * stride;
+                const uint8_t *mrow =
+                    bmap ? bmap->map[p] + (y >> 4) * bmap->stride[p] : NULL;
+                for (int x = x0; x < x1; x++) {
+                    if (mrow && mrow[x >> 1] == 0) {
+                        continue; // no motion, already cleared by adapt_motion
+                    }
+                    __m128i xmm0 = _mm_load_si128(srcpc + x);
+                    __m128i xmm1 = _mm_load_si128(srcpb + x);
+                    __m128i xmm2 = _mm_load_si128(srcpd + x);
                 
-                __m128i xmm3 = _mm_subs_epu16(xmm0, MM_MAX_EPU16(xmm1, xmm2));
-                xmm3 = _mm_cmpeq_epi16(zero, _mm_subs_epu16(xmm3, xcth)); // !(d1 > cthresh && d2 > cthresh)
+                    __m128i xmm3 = _mm_subs_epu16(xmm0, MM_MAX_EPU16(xmm1, xmm2));
+                    xmm3 = _mm_cmpeq_epi16(zero, _mm_subs_epu16(xmm3, xcth)); // !(d1 > cthresh && d2 > cthresh)
+
+                    __m128i xmm4 = _mm_subs_epu16(MM_MIN_EPU16(xmm1, xmm2), xmm0);
+                    xmm4 = _mm_cmpeq_epi16(zero, _mm_subs_epu16(xmm4, xcth)); // !(d1 < -cthresh && d2 < -cthresh)
+
+                    xmm3 = _mm_and_si128(xmm3, xmm4);
+
+                    xmm4 = _mm_add_epi32(_mm_unpacklo_epi16(xmm1, zero),
+                                         _mm_unpacklo_epi16(xmm2, zero)); // lo of (b+d)
+                    xmm1 = _mm_add_epi32(_mm_unpackhi_epi16(xmm1, zero),
+                                         _mm_unpackhi_epi16(xmm2, zero)); // hi of (b+d)
+                    xmm4 = _mm_add_epi32(xmm4, _mm_add_epi32(xmm4, xmm4));      // lo of 3*(b+d)
+                    xmm1 = _mm_add_epi32(xmm1, _mm_add_epi32(xmm1, xmm1));      // hi of 3*(b+d)
+
+                    xmm4 = _mm_sub_epi32(_mm_slli_epi32(_mm_unpacklo_epi16(xmm0, zero), 2), xmm4); // lo of 4*c-3*(b+d)
+                    xmm1 = _mm_sub_epi32(_mm_slli_epi32(_mm_unpackhi_epi16(xmm0, zero), 2), xmm1); // hi of 4*c-3*(b+d)
+
+                    xmm0 = _mm_load_si128(srcpa + x);
+                    xmm4 = _mm_add_epi32(xmm4, _mm_unpacklo_epi16(xmm0, zero)); // lo of a+4*c-3*(b+d)
+                    xmm1 = _mm_add_epi32(xmm1, _mm_unpackhi_epi16(xmm0, zero)); // hi of a+4*c-3*(b+d)
+
+                    xmm0 = _mm_load_si128(srcpe + x);
+                    xmm4 = _mm_add_epi32(xmm4, _mm_unpacklo_epi16(xmm0, zero)); // lo of a+4*c+e-3*(b+d)
+                    xmm1 = _mm_add_epi32(xmm1, _mm_unpackhi_epi16(xmm0, zero)); // hi of a+4*c+e-3*(b+d)
+
+                    xmm4 = _mm_or_si128(_mm_cmpgt_epi32(xmm4, xct6p),
+                                        _mm_cmplt_epi32(xmm4, xct6n));
+                    xmm1 = _mm_or_si128(_mm_cmpgt_epi32(xmm1, xct6p),
+                                        _mm_cmplt_epi32(xmm1, xct6n));
+                    xmm1 = _mm_packs_epi32(xmm4, xmm1);
+
+                    xmm3 = _mm_andnot_si128(xmm3, xmm1);
+
+                    if (mrow) {
+                        xmm3 = _mm_and_si128(xmm3, _mm_load_si128(dstl + x));
+                    }
+
+                    _mm_store_si128(dstl + x, xmm3);
+                }
+            }
+        }
+        if (ystep == 2) {
+            copy_field(dstp, stride * 16, height, first);
+        }
+    }
+
+}
+
+
+/*
+ writes the comb mask of one line from five line pointers. the lines may come
+ from different frames, so woven frames can be evaluated without building
+ them. width is in vectors.
+*/
+static void CM_FUNC_ALIGN VS_CC
+write_combrow_8bit(int cthresh, int width, const uint8_t *a, const uint8_t *b,
+                   const uint8_t *c, const uint8_t *d, const uint8_t *e,
+                   uint8_t *dst)
+{
+    __m128i xcth = _mm_set1_epi8((int8_t)cthresh);
+    __m128i xct6 = _mm_set1_epi16((int16_t)(cthresh * 6));
+    __m128i zero = _mm_setzero_si128();
 
-                __m128i xmm4 = _mm_subs_epu16(MM_MIN_EPU16(xmm1, xmm2), xmm0);
-                xmm4 = _mm_cmpeq_epi16(zero, _mm_subs_epu16(xmm4, xcth)); // !(d1 < -cthresh && d2 < -cthresh)
+    for (int x = 0; x < width; x++) {
+        __m128i xmm0 = comb_metric_8bit((const __m128i *)a, (const __m128i *)b,
+                                        (const __m128i *)c, (const __m128i *)d,
+                                        (const __m128i *)e, x, xcth, xct6,
+                                        zero);
+        _mm_store_si128((__m128i *)dst + x, xmm0);
+    }
+}
 
-                xmm3 = _mm_and_si128(xmm3, xmm4);
 
-                xmm4 = _mm_add_epi32(_mm_unpacklo_epi16(xmm1, zero),
-                                     _mm_unpacklo_epi16(xmm2, zero)); // lo of (b+d)
-                xmm1 = _mm_add_epi32(_mm_unpackhi_epi16(xmm1, zero),
-                                     _mm_unpackhi_epi16(xmm2, zero)); // hi of (b+d)
-                xmm4 = _mm_add_epi32(xmm4, _mm_add_epi32(xmm4, xmm4));      // lo of 3*(b+d)
-                xmm1 = _mm_add_epi32(xmm1, _mm_add_epi32(xmm1, xmm1));      // hi of 3*(b+d)
+/*
+ A pixel can be combed only if it differs more than cthresh from both of its
+ vertical neighbors. is_flat returns 1 if no processed plane has such a
+ difference between adjacent lines (black frames, fades, slates), and stops
+ at the first line which has one.
+*/
+static int CM_FUNC_ALIGN VS_CC
+is_flat_8bit(combmask_t *ch, const VSAPI *vsapi, const VSFrameRef *src)
+{
+    __m128i xcth = _mm_set1_epi8((int8_t)ch->cthresh);
+    __m128i zero = _mm_setzero_si128();
 
-                xmm4 = _mm_sub_epi32(_mm_slli_epi32(_mm_unpacklo_epi16(xmm0, zero), 2), xmm4); // lo of 4*c-3*(b+d)
-                xmm1 = _mm_sub_epi32(_mm_slli_epi32(_mm_unpackhi_epi16(xmm0, zero), 2), xmm1); // hi of 4*c-3*(b+d)
+    for (int p = 0; p < ch->vi->format->numPlanes; p++) {
+        if (ch->planes[p] == 0) {
+            continue;
+        }
 
-                xmm0 = _mm_load_si128(srcpa + x);
-                xmm4 = _mm_add_epi32(xmm4, _mm_unpacklo_epi16(xmm0, zero)); // lo of a+4*c-3*(b+d)
-                xmm1 = _mm_add_epi32(xmm1, _mm_unpackhi_epi16(xmm0, zero)); // hi of a+4*c-3*(b+d)
+        int width = vsapi->getFrameWidth(src, p);
+        int height = vsapi->getFrameHeight(src, p);
+        int stride = vsapi->getStride(src, p);
+        int vwidth = width & ~15;
+        const uint8_t *srcp = vsapi->getReadPtr(src, p);
+
+        for (int y = 1; y < height; y++) {
+            const uint8_t *above = srcp;
+            srcp += stride;
+            __m128i over = zero;
+            for (int x = 0; x < vwidth; x += 16) {
+                __m128i xmm0 = _mm_load_si128((const __m128i *)(above + x));
+                __m128i xmm1 = _mm_load_si128((const __m128i *)(srcp + x));
+                __m128i xmm2 = _mm_or_si128(_mm_subs_epu8(xmm0, xmm1),
+                                            _mm_subs_epu8(xmm1, xmm0));
+                over = _mm_or_si128(over, _mm_subs_epu8(xmm2, xcth));
+            }
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(over, zero)) != 0xFFFF) {
+                return 0;
+            }
+            for (int x = vwidth; x < width; x++) {
+                if (abs(above[x] - srcp[x]) > ch->cthresh) {
+                    return 0;
+                }
+            }
+        }
+    }
+
+    return 1;
+}
 
-                xmm0 = _mm_load_si128(srcpe + x);
-                xmm4 = _mm_add_epi32(xmm4, _mm_unpacklo_epi16(xmm0, zero)); // lo of a+4*c+e-3*(b+d)
-                xmm1 = _mm_add_epi32(xmm1, _mm_unpackhi_epi16(xmm0, zero)); // hi of a+4*c+e-3*(b+d)
 
-                xmm4 = _mm_or_si128(_mm_cmpgt_epi32(xmm4, xct6p),
-                                    _mm_cmplt_epi32(xmm4, xct6n));
-                xmm1 = _mm_or_si128(_mm_cmpgt_epi32(xmm1, xct6p),
-                                    _mm_cmplt_epi32(xmm1, xct6n));
-                xmm1 = _mm_packs_epi32(xmm4, xmm1);
+static int CM_FUNC_ALIGN VS_CC
+is_flat_16bit(combmask_t *ch, const VSAPI *vsapi, const VSFrameRef *src)
+{
+    __m128i xcth = _mm_set1_epi16((int16_t)ch->cthresh);
+    __m128i zero = _mm_setzero_si128();
 
-                xmm3 = _mm_andnot_si128(xmm3, xmm1);
+    for (int p = 0; p < ch->vi->format->numPlanes; p++) {
+        if (ch->planes[p] == 0) {
+            continue;
+        }
 
-                _mm_store_si128(dstp + x, xmm3);
+        int width = vsapi->getFrameWidth(src, p);
+        int height = vsapi->getFrameHeight(src, p);
+        int stride = vsapi->getStride(src, p) / 2;
+        int vwidth = width & ~7;
+        const uint16_t *srcp = (const uint16_t *)vsapi->getReadPtr(src, p);
+
+        for (int y = 1; y < height; y++) {
+            const uint16_t *above = srcp;
+            srcp += stride;
+            __m128i over = zero;
+            for (int x = 0; x < vwidth; x += 8) {
+                __m128i xmm0 = _mm_load_si128((const __m128i *)(above + x));
+                __m128i xmm1 = _mm_load_si128((const __m128i *)(srcp + x));
+                __m128i xmm2 = _mm_or_si128(_mm_subs_epu16(xmm0, xmm1),
+                                            _mm_subs_epu16(xmm1, xmm0));
+                over = _mm_or_si128(over, _mm_subs_epu16(xmm2, xcth));
+            }
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(over, zero)) != 0xFFFF) {
+                return 0;
+            }
+            for (int x = vwidth; x < width; x++) {
+                if (abs(above[x] - srcp[x]) > ch->cthresh) {
+                    return 0;
+                }
             }
-            dstp += stride;
-            srcpa = srcpb;
-            srcpb = srcpc;
-            srcpc = srcpd;
-            srcpd = srcpe;
-            srcpe = (y < height - 3) ? srcpe + stride : srcpe - stride;
         }
     }
 
+    return 1;
 }
 
 
@@ -275,3 +579,11 @@ const func_write_combmask write_combmask_funcs[] = {
     write_combmask_9_10,
     write_combmask_16bit
 };
+
+const func_write_combrow write_combrow = write_combrow_8bit;
+
+const func_is_flat is_flat_funcs[] = {
+    is_flat_8bit,
+    is_flat_16bit,
+    is_flat_16bit
+};